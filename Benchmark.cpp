@@ -0,0 +1,713 @@
+#include <benchmark/benchmark.h>
+#include <cstdlib>
+#include <filesystem>
+#include <numeric>
+#include <random>
+#include "Database.h"
+
+// Benchmarks for the table::Cursor and Serialization hot paths over synthetic users, trips and bookings tables.
+// Table sizes go from 1k rows up to DATABASE_BENCH_MAX_ROWS (100k by default, up to 10M).
+// Generated tables are cached in the system temp directory and reused across runs.
+
+namespace {
+
+    enum TableKind {
+        USERS,
+        TRIPS,
+        BOOKINGS
+    };
+
+    const char* tableName(TableKind kind) {
+        switch (kind) {
+        case USERS: return "users";
+        case TRIPS: return "trips";
+        default: return "bookings";
+        }
+    }
+
+    int64_t maxRows() {
+        const char* configured = std::getenv("DATABASE_BENCH_MAX_ROWS");
+        int64_t rows = configured != nullptr ? std::atoll(configured) : 100000;
+        return std::clamp<int64_t>(rows, 1000, 10000000);
+    }
+
+    class GeneratedRow : public Serialization::Serializable {
+    private:
+        std::vector<std::string> m_fields;
+    public:
+        GeneratedRow(std::vector<std::string> fields) : m_fields(std::move(fields)) {}
+        std::vector<std::string> getContent() const noexcept override {
+            return m_fields;
+        }
+        std::string getPrimaryKey() const override {
+            return m_fields.front();
+        }
+    };
+
+    const std::vector<std::string> destinations = { "Paris", "Rome", "Lisbon", "Oslo", "Vienna", "Prague", "Athens", "Dublin", "Madrid", "Berlin" };
+
+    std::vector<std::string> makeRow(TableKind kind, size_t i, const std::string& padding = "") {
+        switch (kind) {
+        case USERS:
+            return { "user" + std::to_string(i) + "@mail.com", "password" + std::to_string(i) + padding, std::to_string(i * 7919 % 9973), std::to_string(i * 104729 % 99991) };
+        case TRIPS:
+            return { std::to_string(i), destinations[i % destinations.size()] + padding, "2024-" + std::to_string(1 + i % 12) + "-" + std::to_string(1 + i % 28), std::to_string(50 + i % 950) + ".99" };
+        default:
+            return { std::to_string(i), "user" + std::to_string(i % 5000) + "@mail.com" + padding, std::to_string(i % 1000) };
+        }
+    }
+
+    std::filesystem::path dataDirectory() {
+        auto directory = std::filesystem::temp_directory_path() / "database_bench";
+        std::filesystem::create_directories(directory);
+        return directory;
+    }
+
+    // writes a table of the given size once and hands back its path
+    std::string pristineTable(TableKind kind, size_t rows) {
+        auto path = dataDirectory() / (std::string(tableName(kind)) + "_" + std::to_string(rows) + ".csv");
+        if (std::filesystem::exists(path) && std::filesystem::file_size(path) > 0) {
+            return path.string();
+        }
+        Serialization::Serializer serializer;
+        Serialization::FormatDescriptor fd;
+        std::ofstream out(path, std::ios::binary | std::ios::trunc);
+        for (size_t i = 0; i < rows; i++) {
+            GeneratedRow row(makeRow(kind, i));
+            out << serializer.serialize(&row, &fd);
+        }
+        return path.string();
+    }
+
+    // column types of the generated tables in the binary format
+    std::vector<Serialization::ColumnType> columnTypes(TableKind kind) {
+        using Serialization::INTEGER;
+        using Serialization::TEXT;
+        switch (kind) {
+        case USERS: return { TEXT, TEXT, INTEGER, INTEGER };
+        case TRIPS: return { INTEGER, TEXT, TEXT, TEXT };
+        default: return { INTEGER, TEXT, INTEGER };
+        }
+    }
+
+    // the generated table converted to the binary format once
+    std::string binaryTable(TableKind kind, size_t rows) {
+        auto path = dataDirectory() / (std::string(tableName(kind)) + "_" + std::to_string(rows) + ".bin");
+        if (std::filesystem::exists(path) && std::filesystem::file_size(path) > 0) {
+            return path.string();
+        }
+        Serialization::Deserializer deserializer;
+        Serialization::FormatDescriptor fd;
+        Serialization::BinarySerializer serializer;
+        Serialization::BinaryFormatDescriptor binaryFd(columnTypes(kind));
+        table::convertTable(pristineTable(kind, rows).c_str(), deserializer, fd, path.string().c_str(), serializer, binaryFd);
+        return path.string();
+    }
+
+    // private copy of a generated table for benchmarks that modify it
+    std::string scratchTable(TableKind kind, size_t rows) {
+        auto path = dataDirectory() / (std::string(tableName(kind)) + "_scratch.csv");
+        std::filesystem::copy_file(pristineTable(kind, rows), path, std::filesystem::copy_options::overwrite_existing);
+        return path.string();
+    }
+
+    // everything a cursor borrows, kept alive together
+    struct OpenTable {
+        std::string path;
+        fileIO::FileStream stream;
+        Serialization::Deserializer deserializer;
+        Serialization::Serializer serializer;
+        Serialization::FormatDescriptor fd;
+        Serialization::BinaryDeserializer binaryDeserializer;
+        Serialization::BinarySerializer binarySerializer;
+        Serialization::BinaryFormatDescriptor binaryFd;
+        table::Cursor cursor;
+        explicit OpenTable(std::string tablePath, bool binary = false, TableKind kind = BOOKINGS)
+            : path(std::move(tablePath)), stream(path.c_str(), "bench"), binaryFd(columnTypes(kind)),
+            cursor(stream, binary ? binaryDeserializer : deserializer, binary ? binarySerializer : serializer, binary ? static_cast<Serialization::FormatDescriptor&>(binaryFd) : fd) {}
+    };
+
+    void reportRows(benchmark::State& state, int64_t rowsPerIteration, int64_t bytesPerIteration) {
+        state.counters["rows/s"] = benchmark::Counter(static_cast<double>(rowsPerIteration * state.iterations()), benchmark::Counter::kIsRate);
+        state.SetBytesProcessed(bytesPerIteration * state.iterations());
+    }
+
+}
+
+static void BM_Serialize(benchmark::State& state) {
+    auto kind = static_cast<TableKind>(state.range(0));
+    Serialization::Serializer serializer;
+    Serialization::FormatDescriptor fd;
+    GeneratedRow row(makeRow(kind, 123456));
+    int64_t bytes = 0;
+    for (auto _ : state) {
+        auto serialized = serializer.serialize(&row, &fd);
+        bytes += serialized.size();
+        benchmark::DoNotOptimize(serialized);
+    }
+    state.SetLabel(tableName(kind));
+    state.counters["rows/s"] = benchmark::Counter(static_cast<double>(state.iterations()), benchmark::Counter::kIsRate);
+    state.SetBytesProcessed(bytes);
+}
+BENCHMARK(BM_Serialize)->DenseRange(USERS, BOOKINGS);
+
+static void BM_Deserialize(benchmark::State& state) {
+    auto kind = static_cast<TableKind>(state.range(0));
+    Serialization::Serializer serializer;
+    Serialization::Deserializer deserializer;
+    Serialization::FormatDescriptor fd;
+    GeneratedRow row(makeRow(kind, 123456));
+    auto line = serializer.serialize(&row, &fd);
+    line.pop_back();
+    for (auto _ : state) {
+        auto fields = deserializer.deserialize(line.c_str(), &fd);
+        benchmark::DoNotOptimize(fields);
+    }
+    state.SetLabel(tableName(kind));
+    reportRows(state, 1, line.size());
+}
+BENCHMARK(BM_Deserialize)->DenseRange(USERS, BOOKINGS);
+
+// range(1) == 0 reads every row to build the key map, 1 loads the key index saved next to the table
+static void BM_CursorOpen(benchmark::State& state) {
+    auto path = pristineTable(BOOKINGS, state.range(0));
+    bool indexed = state.range(1) == 1;
+    auto keyIndexPath = path + ".keys";
+    if (indexed) {
+        OpenTable table(path);
+        table.cursor.saveKeyIndex();
+    }
+    for (auto _ : state) {
+        state.PauseTiming();
+        if (!indexed) {
+            std::filesystem::remove(keyIndexPath);
+        }
+        state.ResumeTiming();
+
+        auto table = std::make_unique<OpenTable>(path);
+        benchmark::DoNotOptimize(table->cursor.primaryKeyIsInside("0"));
+
+        // the scan's key map is saved as the cursor goes away, that is not part of the open
+        state.PauseTiming();
+        table.reset();
+        state.ResumeTiming();
+    }
+    state.SetLabel(indexed ? "key index" : "scan");
+    state.counters["key index bytes"] = static_cast<double>(OpenTable(path).cursor.keyIndexBytes());
+    reportRows(state, state.range(0), std::filesystem::file_size(path));
+}
+BENCHMARK(BM_CursorOpen)->ArgsProduct({ benchmark::CreateRange(1000, maxRows(), 10), { 0, 1 } })->Unit(benchmark::kMillisecond);
+
+// what every CountingAllocator holds, whatever type it was rebound to
+static size_t countedBytes = 0;
+
+// counts what a std::map keyed like the table allocates, the layout the key index had before
+template<typename T>
+struct CountingAllocator {
+    using value_type = T;
+    CountingAllocator() = default;
+    template<typename U>
+    CountingAllocator(const CountingAllocator<U>&) {}
+    T* allocate(size_t count) {
+        countedBytes += count * sizeof(T);
+        return std::allocator<T>().allocate(count);
+    }
+    void deallocate(T* pointer, size_t count) {
+        countedBytes -= count * sizeof(T);
+        std::allocator<T>().deallocate(pointer, count);
+    }
+    template<typename U>
+    bool operator==(const CountingAllocator<U>&) const { return true; }
+};
+
+// random primary key lookups, range(1) == 0 in a std::map of the keys, 1 in the flat table::KeyIndex
+static void BM_KeyLookup(benchmark::State& state) {
+    size_t rows = state.range(0);
+    bool flat = state.range(1) == 1;
+    using CountedString = std::basic_string<char, std::char_traits<char>, CountingAllocator<char>>;
+    using CountedMap = std::map<CountedString, table::RowLocation, std::less<>, CountingAllocator<std::pair<const CountedString, table::RowLocation>>>;
+    CountedMap tree;
+    table::KeyIndex index;
+    size_t before = countedBytes;
+    for (size_t i = 0; i < rows; i++) {
+        // keys as long as the users' emails, too long to live inside the string
+        auto key = "user" + std::to_string(i) + "@mail.com";
+        table::RowLocation location{ static_cast<std::streamoff>(i * 40), 40 };
+        flat ? static_cast<void>(index.insert(key, location)) : static_cast<void>(tree.emplace(CountedString(key), location));
+    }
+    size_t bytes = flat ? index.bytesReserved() : countedBytes - before;
+
+    std::vector<std::string> probes;
+    for (size_t i = 0; i < 4096; i++) {
+        probes.push_back("user" + std::to_string(i * 2654435761u % rows) + "@mail.com");
+    }
+    size_t next = 0;
+    for (auto _ : state) {
+        const auto& key = probes[next++ & 4095];
+        if (flat) {
+            benchmark::DoNotOptimize(index.find(key));
+        }
+        else {
+            benchmark::DoNotOptimize(tree.find(std::string_view(key)));
+        }
+    }
+    state.SetLabel(flat ? "flat" : "std::map");
+    state.counters["bytes per key"] = static_cast<double>(bytes) / static_cast<double>(rows);
+}
+BENCHMARK(BM_KeyLookup)->ArgsProduct({ benchmark::CreateRange(1000, maxRows() * 10, 10), { 0, 1 } });
+
+// range(1) == 0 scans the csv table, 1 the binary one
+static void BM_FilterFields(benchmark::State& state) {
+    bool binary = state.range(1) == 1;
+    auto path = binary ? binaryTable(BOOKINGS, state.range(0)) : pristineTable(BOOKINGS, state.range(0));
+    OpenTable table(path, binary);
+    // bookings of a single trip, about 0.1% of the rows
+    auto predicate = [](const Serialization::Serializable* row) -> bool {
+        return row->getFieldViews()[2] == "7";
+    };
+    for (auto _ : state) {
+        auto result = table.cursor.filterFields({}, predicate);
+        benchmark::DoNotOptimize(result.size());
+    }
+    state.SetLabel(binary ? "binary" : "csv");
+    reportRows(state, state.range(0), std::filesystem::file_size(path));
+}
+BENCHMARK(BM_FilterFields)->ArgsProduct({ benchmark::CreateRange(1000, maxRows(), 10), { 0, 1 } })->Unit(benchmark::kMillisecond);
+
+// same selection, rejected rows are ruled out on their stored bytes and never split
+static void BM_FilterFieldsEquality(benchmark::State& state) {
+    bool binary = state.range(1) == 1;
+    auto path = binary ? binaryTable(BOOKINGS, state.range(0)) : pristineTable(BOOKINGS, state.range(0));
+    OpenTable table(path, binary);
+    auto rowFilter = table.cursor.equalityFilter(2, "7");
+    auto predicate = [](const Serialization::Serializable* row) -> bool {
+        return row->getFieldViews()[2] == "7";
+    };
+    for (auto _ : state) {
+        auto result = table.cursor.filterFields({}, predicate, rowFilter);
+        benchmark::DoNotOptimize(result.size());
+    }
+    state.SetLabel(binary ? "binary" : "csv");
+    reportRows(state, state.range(0), std::filesystem::file_size(path));
+}
+BENCHMARK(BM_FilterFieldsEquality)->ArgsProduct({ benchmark::CreateRange(1000, maxRows(), 10), { 0, 1 } })->Unit(benchmark::kMillisecond);
+
+// SELECT bookingId WHERE tripId == 7, range(1) == 0 scans the rows, 1 reads two of the three column files
+static void BM_SelectProjection(benchmark::State& state) {
+    auto path = pristineTable(BOOKINGS, state.range(0));
+    OpenTable open(path);
+    table::Table bookings(open.cursor, { "bookingId", "userEmail", "tripId" }, "bookings");
+    bool columnar = state.range(1) == 1;
+    if (columnar) {
+        bookings.createColumnStore();
+    }
+    auto query = query::QueryBuilder(query::SELECT).setTarget({ "bookingId" }).whereEquals("tripId", "7").build();
+    for (auto _ : state) {
+        auto result = bookings.executeQuery(query);
+        benchmark::DoNotOptimize(result->size());
+    }
+    state.SetLabel(columnar ? "columns" : "rows");
+    reportRows(state, state.range(0), std::filesystem::file_size(path));
+}
+BENCHMARK(BM_SelectProjection)->ArgsProduct({ benchmark::CreateRange(1000, maxRows(), 10), { 0, 1 } })->Unit(benchmark::kMillisecond);
+
+// trips priced 100 to 200, range(1) == 0 parses the price in a lambda, 1 runs the compiled expression
+static void BM_SelectPriceRange(benchmark::State& state) {
+    auto path = pristineTable(TRIPS, state.range(0));
+    OpenTable open(path);
+    table::Table trips(open.cursor, { "tripId", "destination", "departureDate", "price" }, "trips",
+        { Serialization::INTEGER, Serialization::TEXT, Serialization::DATE, Serialization::DECIMAL });
+    bool compiled = state.range(1) == 1;
+    auto query = compiled
+        ? query::QueryBuilder(query::SELECT).where(query::range("price", 100, 200)).build()
+        : query::QueryBuilder(query::SELECT).setPredicate([](const Serialization::Serializable* row) -> bool {
+            double price = std::stod(row->getContent()[3]);
+            return price >= 100 && price <= 200;
+            }).build();
+    for (auto _ : state) {
+        auto result = trips.executeQuery(query);
+        benchmark::DoNotOptimize(result->size());
+    }
+    state.SetLabel(compiled ? "expression" : "lambda");
+    reportRows(state, state.range(0), std::filesystem::file_size(path));
+}
+BENCHMARK(BM_SelectPriceRange)->ArgsProduct({ benchmark::CreateRange(1000, maxRows(), 10), { 0, 1 } })->Unit(benchmark::kMillisecond);
+
+// trips leaving in the second half of the year priced up to 300, both run the same compiled expression
+// range(1) == 0 tests it row by row, 1 a block of rows at a time
+static void BM_FilterDatePriceBatch(benchmark::State& state) {
+    auto path = pristineTable(TRIPS, state.range(0));
+    OpenTable open(path);
+    auto compiled = query::CompiledExpression::compile(query::ge("departureDate", "2024-07-01") && query::le("price", 300),
+        { "tripId", "destination", "departureDate", "price" }, columnTypes(TRIPS));
+    bool batch = state.range(1) == 1;
+    for (auto _ : state) {
+        auto result = batch
+            ? open.cursor.filterFieldsBatch({}, *compiled, query::ScanOptions())
+            : open.cursor.filterFields({}, [&](const Serialization::Serializable* row) { return compiled->evaluate(row->getFieldViews()); });
+        benchmark::DoNotOptimize(result.size());
+    }
+    state.SetLabel(batch ? "batch" : "row");
+    reportRows(state, state.range(0), std::filesystem::file_size(path));
+}
+BENCHMARK(BM_FilterDatePriceBatch)->ArgsProduct({ benchmark::CreateRange(1000, maxRows(), 10), { 0, 1 } })->Unit(benchmark::kMillisecond);
+
+static void BM_InsertRows(benchmark::State& state) {
+    size_t rows = state.range(0);
+    std::vector<GeneratedRow> generated;
+    generated.reserve(rows);
+    for (size_t i = 0; i < rows; i++) {
+        generated.emplace_back(makeRow(BOOKINGS, i));
+    }
+    std::vector<Serialization::Serializable*> payload;
+    for (auto& row : generated) {
+        payload.push_back(&row);
+    }
+
+    auto path = (dataDirectory() / "bookings_insert.csv").string();
+    int64_t bytes = 0;
+    for (auto _ : state) {
+        state.PauseTiming();
+        std::filesystem::remove(path);
+        auto table = std::make_unique<OpenTable>(path);
+        state.ResumeTiming();
+
+        table->cursor.insertRows(payload);
+
+        state.PauseTiming();
+        bytes = std::filesystem::file_size(path);
+        table.reset();
+        state.ResumeTiming();
+    }
+    reportRows(state, rows, bytes);
+}
+BENCHMARK(BM_InsertRows)->RangeMultiplier(10)->Range(1000, maxRows())->Unit(benchmark::kMillisecond);
+
+// the same rows as BM_InsertRows, serialized into one buffer and written a few megabytes at a time
+static void BM_BulkLoad(benchmark::State& state) {
+    size_t rows = state.range(0);
+    std::vector<GeneratedRow> generated;
+    generated.reserve(rows);
+    for (size_t i = 0; i < rows; i++) {
+        generated.emplace_back(makeRow(BOOKINGS, i));
+    }
+    std::vector<Serialization::Serializable*> payload;
+    for (auto& row : generated) {
+        payload.push_back(&row);
+    }
+
+    auto path = (dataDirectory() / "bookings_bulk.csv").string();
+    table::BulkLoadOptions options;
+    options.reportCollisions = false;
+    int64_t bytes = 0;
+    for (auto _ : state) {
+        state.PauseTiming();
+        std::filesystem::remove(path);
+        auto table = std::make_unique<OpenTable>(path);
+        state.ResumeTiming();
+
+        table->cursor.bulkLoad(payload, options);
+
+        state.PauseTiming();
+        bytes = std::filesystem::file_size(path);
+        table.reset();
+        state.ResumeTiming();
+    }
+    reportRows(state, rows, bytes);
+}
+BENCHMARK(BM_BulkLoad)->RangeMultiplier(10)->Range(1000, maxRows())->Unit(benchmark::kMillisecond);
+
+// range(1) == 0 rewrites rows in place, 1 grows them so they move to the end of the file
+static void BM_UpdateRow(benchmark::State& state) {
+    size_t rows = state.range(0);
+    bool relocated = state.range(1) == 1;
+    auto table = std::make_unique<OpenTable>(scratchTable(BOOKINGS, rows));
+    std::mt19937_64 random(42);
+    std::uniform_int_distribution<size_t> pick(0, rows - 1);
+    std::string padding = relocated ? std::string(64, 'x') : "";
+    // a grown row fits its new slot from then on, so each key is grown once per fresh copy of the table
+    std::vector<size_t> order(rows);
+    std::iota(order.begin(), order.end(), 0);
+    std::shuffle(order.begin(), order.end(), random);
+    size_t next = 0;
+    int64_t bytes = 0;
+    for (auto _ : state) {
+        if (relocated && next == rows) {
+            state.PauseTiming();
+            table.reset();
+            table = std::make_unique<OpenTable>(scratchTable(BOOKINGS, rows));
+            std::shuffle(order.begin(), order.end(), random);
+            next = 0;
+            state.ResumeTiming();
+        }
+        GeneratedRow row(makeRow(BOOKINGS, relocated ? order[next++] : pick(random), padding));
+        table->cursor.updateRow(&row);
+        bytes += row.getContent()[1].size();
+    }
+    state.SetLabel(relocated ? "relocated" : "in place");
+    state.counters["rows/s"] = benchmark::Counter(static_cast<double>(state.iterations()), benchmark::Counter::kIsRate);
+    state.SetBytesProcessed(bytes);
+}
+BENCHMARK(BM_UpdateRow)->ArgsProduct({ benchmark::CreateRange(1000, maxRows(), 10), { 0, 1 } });
+
+// primary-key reads skewed the way popular trips are, with and without the row cache in front of the file
+static void BM_HotKeyReads(benchmark::State& state) {
+    size_t rows = state.range(0);
+    bool cached = state.range(1) == 1;
+    OpenTable table(pristineTable(TRIPS, rows));
+    if (cached) {
+        table.cursor.setRowCache(1 << 20);
+    }
+    // zipf with s = 1, a few trips take most of the reads
+    std::vector<double> weights(rows);
+    for (size_t i = 0; i < rows; i++) {
+        weights[i] = 1.0 / static_cast<double>(i + 1);
+    }
+    std::mt19937_64 random(42);
+    std::discrete_distribution<size_t> pick(weights.begin(), weights.end());
+    std::vector<std::string> probes;
+    for (size_t i = 0; i < 65536; i++) {
+        probes.push_back(std::to_string(pick(random) * 2654435761u % rows));
+    }
+    size_t next = 0;
+    std::string row;
+    for (auto _ : state) {
+        benchmark::DoNotOptimize(table.cursor.readRow(probes[next++ & 65535], row));
+    }
+    auto counters = table.cursor.rowCacheCounters();
+    state.SetLabel(cached ? "cached" : "uncached");
+    state.counters["rows/s"] = benchmark::Counter(static_cast<double>(state.iterations()), benchmark::Counter::kIsRate);
+    state.counters["hits"] = static_cast<double>(counters.hits);
+    state.counters["misses"] = static_cast<double>(counters.misses);
+    state.counters["evictions"] = static_cast<double>(counters.evictions);
+}
+BENCHMARK(BM_HotKeyReads)->ArgsProduct({ benchmark::CreateRange(1000, maxRows(), 10), { 0, 1 } });
+
+// uniform primary-key reads with no page pool, the default budget, and a budget that holds the whole table
+static void BM_PagedReads(benchmark::State& state) {
+    size_t rows = state.range(0);
+    OpenTable table(pristineTable(TRIPS, rows));
+    size_t budget = state.range(1) == 0 ? 0 : state.range(1) == 1 ? fileIO::PagePool::defaultBudget : static_cast<size_t>(table.stream.size()) + fileIO::PagePool::pageSize;
+    table.stream.setPageBudget(budget);
+    std::mt19937_64 random(42);
+    std::uniform_int_distribution<size_t> pick(0, rows - 1);
+    std::vector<std::string> probes;
+    for (size_t i = 0; i < 65536; i++) {
+        probes.push_back(std::to_string(pick(random)));
+    }
+    size_t next = 0;
+    std::string row;
+    for (auto _ : state) {
+        benchmark::DoNotOptimize(table.cursor.readRow(probes[next++ & 65535], row));
+    }
+    auto counters = table.stream.pageCounters();
+    state.SetLabel(std::to_string(budget >> 10) + " KB of pages");
+    state.counters["rows/s"] = benchmark::Counter(static_cast<double>(state.iterations()), benchmark::Counter::kIsRate);
+    state.counters["page hits"] = static_cast<double>(counters.hits);
+    state.counters["page misses"] = static_cast<double>(counters.misses);
+}
+BENCHMARK(BM_PagedReads)->ArgsProduct({ benchmark::CreateRange(1000, maxRows(), 10), { 0, 1, 2 } });
+
+// bookings of one trip in 50 listed with their trip, range(1) == 0 looks each trip up on its own, 1 runs a JOIN
+static void BM_JoinBookingsTrips(benchmark::State& state) {
+    OpenTable bookings(pristineTable(BOOKINGS, state.range(0)));
+    OpenTable trips(pristineTable(TRIPS, 1000), false, TRIPS);
+    table::Table bookingsTable(bookings.cursor, { "bookingId", "userEmail", "tripId" }, "bookings");
+    table::Table tripsTable(trips.cursor, { "tripId", "destination", "departureDate", "price" }, "trips");
+    bool joined = state.range(1) == 1;
+    auto oneTripIn50 = [](const Serialization::Serializable* row) -> bool {
+        auto tripId = row->getFieldViews()[2];
+        return tripId.ends_with("00") || tripId.ends_with("50");
+    };
+    size_t rows = 0;
+    for (auto _ : state) {
+        if (joined) {
+            auto query = query::QueryBuilder(query::JOIN).setPredicate(oneTripIn50).join(tripsTable, "tripId", "tripId", { "destination" }).build();
+            rows = bookingsTable.executeQuery(query)->size();
+        }
+        else {
+            auto query = query::QueryBuilder(query::SELECT).setPredicate(oneTripIn50).build();
+            auto result = bookingsTable.executeQuery(query);
+            rows = 0;
+            for (const auto* booking : *result) {
+                auto lookup = query::QueryBuilder(query::SELECT).setTarget({ "destination" }).wherePrimaryKey(std::string(booking->getFieldViews()[2])).build();
+                rows += tripsTable.executeQuery(lookup)->size();
+            }
+        }
+        benchmark::DoNotOptimize(rows);
+    }
+    state.SetLabel(joined ? "join" : "lookup per row");
+    state.counters["joined rows"] = static_cast<double>(rows);
+}
+BENCHMARK(BM_JoinBookingsTrips)->ArgsProduct({ benchmark::CreateRange(1000, maxRows(), 10), { 0, 1 } })->Unit(benchmark::kMillisecond);
+
+// bookings per trip, range(1) == 0 materializes the table and counts in the caller, 1 aggregates inside the scan
+static void BM_BookingsPerTrip(benchmark::State& state) {
+    OpenTable bookings(pristineTable(BOOKINGS, state.range(0)));
+    table::Table bookingsTable(bookings.cursor, { "bookingId", "userEmail", "tripId" }, "bookings",
+        { Serialization::INTEGER, Serialization::TEXT, Serialization::INTEGER });
+    bool streamed = state.range(1) == 1;
+    size_t groups = 0;
+    size_t bytes = 0;
+    for (auto _ : state) {
+        if (streamed) {
+            auto query = query::QueryBuilder(query::AGGREGATE).groupBy({ "tripId" }).aggregate(query::Aggregate::COUNT).build();
+            auto result = bookingsTable.executeQuery(query);
+            groups = result->size();
+            bytes = result->bytesReserved();
+        }
+        else {
+            auto query = query::QueryBuilder(query::SELECT).build();
+            auto result = bookingsTable.executeQuery(query);
+            std::unordered_map<std::string, size_t> perTrip;
+            for (const auto* row : *result) {
+                perTrip[std::string(row->getFieldViews()[2])]++;
+            }
+            groups = perTrip.size();
+            bytes = result->bytesReserved();
+        }
+        benchmark::DoNotOptimize(groups);
+    }
+    state.SetLabel(streamed ? "aggregate" : "materialize");
+    state.counters["result bytes"] = static_cast<double>(bytes);
+    reportRows(state, state.range(0), std::filesystem::file_size(bookings.path));
+}
+BENCHMARK(BM_BookingsPerTrip)->ArgsProduct({ benchmark::CreateRange(1000, maxRows(), 10), { 0, 1 } })->Unit(benchmark::kMillisecond);
+
+// the ten cheapest trips, range(1) == 0 materializes the table and sorts in the caller, 1 keeps the ten rows in a heap during the scan
+static void BM_CheapestTrips(benchmark::State& state) {
+    OpenTable trips(pristineTable(TRIPS, state.range(0)));
+    table::Table tripsTable(trips.cursor, { "tripId", "destination", "departureDate", "price" }, "trips",
+        { Serialization::INTEGER, Serialization::TEXT, Serialization::DATE, Serialization::DECIMAL });
+    bool bounded = state.range(1) == 1;
+    size_t bytes = 0;
+    for (auto _ : state) {
+        std::vector<std::string> cheapest;
+        if (bounded) {
+            auto query = query::QueryBuilder(query::SELECT).orderBy("price").limit(10).build();
+            auto result = tripsTable.executeQuery(query);
+            for (const auto* row : *result) {
+                cheapest.emplace_back(row->getFieldViews()[0]);
+            }
+            bytes = result->bytesReserved();
+        }
+        else {
+            auto query = query::QueryBuilder(query::SELECT).build();
+            auto result = tripsTable.executeQuery(query);
+            std::vector<const Serialization::RowView*> rows(result->begin(), result->end());
+            auto price = [](const Serialization::RowView* row) { return std::stod(std::string(row->getFieldViews()[3])); };
+            std::stable_sort(rows.begin(), rows.end(), [&](const auto* left, const auto* right) { return price(left) < price(right); });
+            for (size_t i = 0; i < std::min<size_t>(10, rows.size()); i++) {
+                cheapest.emplace_back(rows[i]->getFieldViews()[0]);
+            }
+            bytes = result->bytesReserved();
+        }
+        benchmark::DoNotOptimize(cheapest);
+    }
+    state.SetLabel(bounded ? "top-k" : "materialize");
+    state.counters["result bytes"] = static_cast<double>(bytes);
+    reportRows(state, state.range(0), std::filesystem::file_size(trips.path));
+}
+BENCHMARK(BM_CheapestTrips)->ArgsProduct({ benchmark::CreateRange(1000, maxRows(), 10), { 0, 1 } })->Unit(benchmark::kMillisecond);
+
+// a booking adds a booking row and rewrites its trip, range(0) == 0 logs each table on its own, 1 commits both in one transaction
+static void BM_BookTrip(benchmark::State& state) {
+    bool transactional = state.range(0) == 1;
+    OpenTable trips(scratchTable(TRIPS, 1000), false, TRIPS);
+    auto bookingsPath = (dataDirectory() / "bookings_booked.csv").string();
+    std::filesystem::remove(bookingsPath);
+    OpenTable bookings(bookingsPath);
+    for (auto name : { "trips.wal", "bookings.wal", "shared.wal" }) {
+        std::filesystem::remove(dataDirectory() / name);
+    }
+    wal::WriteAheadLog tripsLog((dataDirectory() / "trips.wal").string());
+    wal::WriteAheadLog bookingsLog((dataDirectory() / "bookings.wal").string());
+    wal::WriteAheadLog sharedLog((dataDirectory() / "shared.wal").string());
+    trips.cursor.attachLog(transactional ? sharedLog : tripsLog);
+    bookings.cursor.attachLog(transactional ? sharedLog : bookingsLog);
+    table::Table tripsTable(trips.cursor, { "tripId", "destination", "departureDate", "price" }, "trips");
+    table::Table bookingsTable(bookings.cursor, { "bookingId", "userEmail", "tripId" }, "bookings");
+
+    size_t booked = 0;
+    for (auto _ : state) {
+        auto tripId = std::to_string(booked % 1000);
+        GeneratedRow booking(makeRow(BOOKINGS, booked));
+        GeneratedRow trip(makeRow(TRIPS, booked % 1000));
+        if (transactional) {
+            table::Transaction transaction;
+            if (transaction.exists(tripsTable, tripId)) {
+                transaction.insert(bookingsTable, &booking);
+                transaction.update(tripsTable, &trip);
+                transaction.commit();
+            }
+        }
+        else {
+            auto check = query::QueryBuilder(query::SELECT).wherePrimaryKey(tripId).build();
+            if (tripsTable.exists(check)) {
+                auto insert = query::QueryBuilder(query::INSERT).setPayLoad({ &booking }).build();
+                bookingsTable.executeQuery(insert);
+                auto update = query::QueryBuilder(query::UPDATE).setPayLoad({ &trip }).build();
+                tripsTable.executeQuery(update);
+            }
+        }
+        booked++;
+    }
+    auto flushes = tripsLog.groupCount() + bookingsLog.groupCount() + sharedLog.groupCount();
+    state.SetLabel(transactional ? "transaction" : "separate");
+    state.counters["flushes/booking"] = static_cast<double>(flushes) / std::max<size_t>(booked, 1);
+    state.counters["bookings/s"] = benchmark::Counter(static_cast<double>(booked), benchmark::Counter::kIsRate);
+}
+BENCHMARK(BM_BookTrip)->DenseRange(0, 1)->Unit(benchmark::kMicrosecond);
+
+// thread 0 keeps rewriting rows while the other threads scan the same cursor
+static void BM_ScanWhileUpdating(benchmark::State& state) {
+    // the loop starts and ends with every thread lined up, so thread 0 owns setup and teardown
+    static std::unique_ptr<OpenTable> table;
+    if (state.thread_index() == 0) {
+        table = std::make_unique<OpenTable>(scratchTable(BOOKINGS, 100000));
+    }
+    auto predicate = [](const Serialization::Serializable* row) -> bool {
+        return row->getFieldViews()[2] == "7";
+    };
+    std::mt19937_64 random(state.thread_index());
+    std::uniform_int_distribution<size_t> pick(0, 100000 - 1);
+    for (auto _ : state) {
+        if (state.thread_index() == 0) {
+            GeneratedRow row(makeRow(BOOKINGS, pick(random), std::string(64, 'x')));
+            table->cursor.updateRow(&row);
+        }
+        else {
+            auto result = table->cursor.filterFields({}, predicate);
+            benchmark::DoNotOptimize(result.size());
+        }
+    }
+    if (state.thread_index() == 0) {
+        table.reset();
+    }
+}
+BENCHMARK(BM_ScanWhileUpdating)->ThreadRange(2, 8)->UseRealTime()->Unit(benchmark::kMillisecond);
+
+static void BM_DeleteRows(benchmark::State& state) {
+    size_t rows = state.range(0);
+    // every hundredth booking
+    auto predicate = [](const Serialization::Serializable* row) -> bool {
+        auto id = row->getFieldViews()[0];
+        return id.size() >= 2 && id.ends_with("00");
+    };
+    int64_t bytes = std::filesystem::file_size(pristineTable(BOOKINGS, rows));
+    for (auto _ : state) {
+        state.PauseTiming();
+        auto table = std::make_unique<OpenTable>(scratchTable(BOOKINGS, rows));
+        state.ResumeTiming();
+
+        table->cursor.deleteRows(predicate);
+
+        state.PauseTiming();
+        table.reset();
+        state.ResumeTiming();
+    }
+    reportRows(state, rows, bytes);
+}
+BENCHMARK(BM_DeleteRows)->RangeMultiplier(10)->Range(1000, maxRows())->Unit(benchmark::kMillisecond);
+
+BENCHMARK_MAIN();
@@ -1,17 +1,318 @@
 #include "Database.h"
+#include <cstring>
+#include <filesystem>
+#include <charconv>
+#include <set>
+#ifdef _WIN32
+#define WIN32_LEAN_AND_MEAN
+#define NOMINMAX
+#include <windows.h>
+#else
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
 
 
-fileIO::FileStream::FileStream(const char* path, const char* tag) : m_completePath(path), tag(tag) {
-    fileStream.open(m_completePath, std::ios::in | std::ios::out | std::ios::app);
+fileIO::PagePool::Pin::Pin(Pin&& other) noexcept : m_pool(other.m_pool), m_frame(other.m_frame), m_data(other.m_data), m_size(other.m_size)
+{
+    other.m_pool = nullptr;
+}
+
+fileIO::PagePool::Pin& fileIO::PagePool::Pin::operator=(Pin&& other) noexcept
+{
+    if (this != &other) {
+        release();
+        std::swap(m_pool, other.m_pool);
+        m_frame = other.m_frame;
+        m_data = other.m_data;
+        m_size = other.m_size;
+    }
+    return *this;
+}
+
+fileIO::PagePool::Pin::~Pin() noexcept
+{
+    release();
+}
+
+void fileIO::PagePool::Pin::release() noexcept
+{
+    if (m_pool != nullptr) {
+        m_pool->unpin(m_frame);
+        m_pool = nullptr;
+    }
+}
+
+fileIO::PagePool::PagePool(PageReader read, PageWriter write, size_t budgetBytes) : m_read(std::move(read)), m_write(std::move(write)), m_frameLimit(budgetBytes / pageSize)
+{
+    // frames are handed out by index while the lock is dropped, so they must never move
+    m_frames.reserve(m_frameLimit);
+}
+
+std::optional<size_t> fileIO::PagePool::freeFrame()
+{
+    if (m_frames.size() < m_frameLimit) {
+        m_frames.emplace_back();
+        m_frames.back().data = std::make_unique<char[]>(pageSize);
+        return m_frames.size() - 1;
+    }
+    // the first turn of the hand clears the marks, the second finds an unmarked page unless all are pinned
+    for (size_t step = 0; step < 2 * m_frames.size(); step++) {
+        size_t place = m_hand;
+        m_hand = (m_hand + 1) % m_frames.size();
+        Frame& frame = m_frames[place];
+        if (frame.pins != 0) {
+            continue;
+        }
+        if (!frame.used) {
+            return place;
+        }
+        if (frame.referenced) {
+            frame.referenced = false;
+            continue;
+        }
+        if (frame.dirty && !writeBack(frame)) {
+            continue;
+        }
+        m_places.erase(frame.page);
+        frame.used = false;
+        m_counters.evictions++;
+        return place;
+    }
+    return std::nullopt;
+}
+
+bool fileIO::PagePool::writeBack(Frame& frame)
+{
+    if (!m_write(frame.page, frame.data.get(), frame.length)) {
+        return false;
+    }
+    frame.dirty = false;
+    m_counters.writebacks++;
+    return true;
+}
+
+void fileIO::PagePool::unpin(size_t frame) noexcept
+{
+    std::lock_guard<std::mutex> guard(m_lock);
+    if (frame < m_frames.size() && m_frames[frame].pins != 0) {
+        m_frames[frame].pins--;
+    }
+}
+
+fileIO::PagePool::Pin fileIO::PagePool::pin(uint64_t page)
+{
+    if (m_frameLimit.load() == 0) {
+        return Pin();
+    }
+    size_t place;
+    uint64_t epoch;
+    {
+        std::lock_guard<std::mutex> guard(m_lock);
+        auto where = m_places.find(page);
+        if (where != m_places.end()) {
+            Frame& frame = m_frames[where->second];
+            frame.pins++;
+            frame.referenced = true;
+            m_counters.hits++;
+            return Pin(this, where->second, frame.data.get(), frame.length);
+        }
+        auto free = freeFrame();
+        if (!free) {
+            return Pin();
+        }
+        place = *free;
+        // pinned but not findable, nobody else takes the frame while the page is read in
+        m_frames[place].pins = 1;
+        m_frames[place].page = page;
+        m_counters.misses++;
+        epoch = m_epoch;
+    }
+
+    // other pages are served while this one is read
+    char* data = m_frames[place].data.get();
+    size_t length = m_read(page, data);
+
+    std::lock_guard<std::mutex> guard(m_lock);
+    Frame& frame = m_frames[place];
+    frame.length = length;
+    auto where = m_places.find(page);
+    if (where != m_places.end()) {
+        // another reader brought the page in meanwhile, this frame goes back once unpinned
+        frame.pins = 0;
+        Frame& resident = m_frames[where->second];
+        resident.pins++;
+        resident.referenced = true;
+        return Pin(this, where->second, resident.data.get(), resident.length);
+    }
+    if (epoch == m_epoch) {
+        frame.used = true;
+        frame.dirty = false;
+        frame.referenced = false;
+        m_places.emplace(page, place);
+    }
+    return Pin(this, place, data, length);
+}
+
+bool fileIO::PagePool::write(uint64_t offset, const char* data, size_t length)
+{
+    if (length == 0) {
+        return true;
+    }
+    std::lock_guard<std::mutex> guard(m_lock);
+    m_epoch++;
+    bool absorbed = true;
+    uint64_t first = offset / pageSize;
+    uint64_t last = (offset + length - 1) / pageSize;
+    for (uint64_t page = first; page <= last; page++) {
+        auto where = m_places.find(page);
+        if (where == m_places.end()) {
+            absorbed = false;
+            continue;
+        }
+        Frame& frame = m_frames[where->second];
+        size_t begin = page == first ? static_cast<size_t>(offset % pageSize) : 0;
+        size_t from = static_cast<size_t>(page * pageSize + begin - offset);
+        size_t count = std::min(pageSize - begin, length - from);
+        if (begin > frame.length) {
+            // the write leaves a hole after the page's bytes, the frame cannot stand for the page anymore
+            if ((!frame.dirty || writeBack(frame)) && frame.pins == 0) {
+                m_places.erase(where);
+                frame.used = false;
+            }
+            absorbed = false;
+            continue;
+        }
+        std::memcpy(frame.data.get() + begin, data + from, count);
+        if (begin + count > frame.length) {
+            // the file grows, the caller has to write it through
+            frame.length = begin + count;
+            absorbed = false;
+        }
+    }
+    if (absorbed) {
+        for (uint64_t page = first; page <= last; page++) {
+            m_frames[m_places.find(page)->second].dirty = true;
+        }
+    }
+    return absorbed;
+}
+
+bool fileIO::PagePool::flush()
+{
+    std::lock_guard<std::mutex> guard(m_lock);
+    // in file order, the write back is one sweep over the file
+    std::vector<size_t> dirty;
+    for (size_t place = 0; place < m_frames.size(); place++) {
+        if (m_frames[place].used && m_frames[place].dirty) {
+            dirty.push_back(place);
+        }
+    }
+    std::sort(dirty.begin(), dirty.end(), [this](size_t left, size_t right) {
+        return m_frames[left].page < m_frames[right].page;
+        });
+    bool written = true;
+    for (size_t place : dirty) {
+        written = writeBack(m_frames[place]) && written;
+    }
+    return written;
+}
+
+void fileIO::PagePool::discard()
+{
+    std::lock_guard<std::mutex> guard(m_lock);
+    m_epoch++;
+    m_places.clear();
+    for (auto& frame : m_frames) {
+        frame.used = false;
+        frame.dirty = false;
+        frame.referenced = false;
+    }
+}
+
+bool fileIO::PagePool::resize(size_t budgetBytes)
+{
+    bool written = flush();
+    std::lock_guard<std::mutex> guard(m_lock);
+    m_epoch++;
+    m_places.clear();
+    m_frames.clear();
+    m_frames.shrink_to_fit();
+    m_hand = 0;
+    m_counters = Counters();
+    m_frameLimit = budgetBytes / pageSize;
+    m_frames.reserve(m_frameLimit);
+    return written;
+}
+
+size_t fileIO::PagePool::budget() noexcept
+{
+    return m_frameLimit.load() * pageSize;
+}
+
+fileIO::PagePool::Counters fileIO::PagePool::counters()
+{
+    std::lock_guard<std::mutex> guard(m_lock);
+    Counters counters = m_counters;
+    counters.resident = m_places.size();
+    for (const auto& frame : m_frames) {
+        counters.dirty += frame.used && frame.dirty ? 1 : 0;
+    }
+    return counters;
+}
+
+fileIO::FileStream::FileStream(const char* path, const char* tag) : m_completePath(path), tag(tag),
+    m_pages([this](uint64_t page, char* dest) { return readDirect(static_cast<std::streamoff>(page * PagePool::pageSize), PagePool::pageSize, dest); },
+        [this](uint64_t page, const char* data, size_t length) { return writeDirect(static_cast<std::streamoff>(page * PagePool::pageSize), data, length); }) {
+    open();
     if (!fileStream.is_open()) {
         std::cout << "Error opening file: " << m_completePath << std::endl;
     }
 }
 
+void fileIO::FileStream::open()
+{
+    // binary mode keeps byte offsets stable and no app flag so rows can be rewritten in place
+    fileStream.open(m_completePath, std::ios::in | std::ios::out | std::ios::binary);
+    if (!fileStream.is_open()) {
+        // in|out refuses to create the file
+        std::ofstream(m_completePath, std::ios::binary).close();
+        fileStream.clear();
+        fileStream.open(m_completePath, std::ios::in | std::ios::out | std::ios::binary);
+    }
+
+    closePageHandle();
+#ifdef _WIN32
+    HANDLE handle = CreateFileA(m_completePath, GENERIC_READ | GENERIC_WRITE, FILE_SHARE_READ | FILE_SHARE_WRITE | FILE_SHARE_DELETE, nullptr, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, nullptr);
+    m_pageHandle = handle == INVALID_HANDLE_VALUE ? nullptr : handle;
+#else
+    m_pageDescriptor = ::open(m_completePath, O_RDWR);
+#endif
+}
+
+void fileIO::FileStream::closePageHandle() noexcept
+{
+#ifdef _WIN32
+    if (m_pageHandle != nullptr) {
+        CloseHandle(m_pageHandle);
+        m_pageHandle = nullptr;
+    }
+#else
+    if (m_pageDescriptor >= 0) {
+        ::close(m_pageDescriptor);
+        m_pageDescriptor = -1;
+    }
+#endif
+}
+
 fileIO::FileStream::~FileStream() noexcept {
+    flush();
     if (fileStream.is_open()) {
         fileStream.close();
     }
+    closePageHandle();
 }
 
 fileIO::FileStream & fileIO::FileStream::operator=(const FileStream & other)
@@ -24,102 +325,314 @@ fileIO::FileStream & fileIO::FileStream::operator=(const FileStream & other)
     tag = other.tag;
 
     if (!fileStream.is_open() || fileStream.fail()) {
-        fileStream.open(m_completePath, std::ios::in | std::ios::out | std::ios::app);
+        open();
     }
 
     return *this;
 }
 
-fileIO::FileStream::FileStream(const FileStream& other) : m_completePath(other.m_completePath), tag(other.tag) {
+fileIO::FileStream::FileStream(const FileStream& other) : m_completePath(other.m_completePath), tag(other.tag),
+    m_pages([this](uint64_t page, char* dest) { return readDirect(static_cast<std::streamoff>(page * PagePool::pageSize), PagePool::pageSize, dest); },
+        [this](uint64_t page, const char* data, size_t length) { return writeDirect(static_cast<std::streamoff>(page * PagePool::pageSize), data, length); },
+        other.m_pages.budget()) {
+    // the copy reads the file through its own handle, it has to hold what the other one still keeps in memory
+    other.flush();
     if (!fileStream.is_open() || fileStream.fail()) {
-        fileStream.open(m_completePath, std::ios::in | std::ios::out | std::ios::app);
+        open();
     }
 }
 
-#include <sstream>
+void fileIO::FileStream::reopen()
+{
+    flush();
+    fileStream.close();
+    fileStream.clear();
+    open();
+    m_pages.discard();
+
+    if (!fileStream.is_open()) {
+        std::cerr << "Error opening file: " << m_completePath << std::endl;
+        std::cerr << "Failbit: " << fileStream.fail() << " Badbit: " << fileStream.bad() << " Eofbit: " << fileStream.eof() << std::endl;
+    }
+   
+}
 
-bool fileIO::FileStream::deleteLine(size_t lineNumber, const char * delim)
+bool fileIO::FileStream::replaceWith(const std::string& replacementPath)
 {
-    if (!fileStream.is_open() || fileStream.fail()) {
-        std::cout << "Error opening file: " << m_completePath << std::endl;
-        return false;
+    m_writes++;
+    // the handles have to be closed before the rename on Windows
+    flush();
+    fileStream.close();
+    closePageHandle();
+    std::error_code error;
+    std::filesystem::rename(replacementPath, m_completePath, error);
+    if (error) {
+        std::cerr << "Error replacing file: " << m_completePath << " " << error.message() << std::endl;
     }
+    else {
+        // make the rename itself durable
+        auto directory = std::filesystem::absolute(m_completePath).parent_path();
+        syncFile(directory.string().c_str());
+    }
+    fileStream.clear();
+    open();
+    // the pages held belong to the file that was replaced
+    m_pages.discard();
+    return !error;
+}
 
-    std::vector<std::string> lines = std::vector<std::string>();
+bool fileIO::FileStream::truncate(std::streamoff length)
+{
+    m_writes++;
+    flush();
+    fileStream.close();
+    closePageHandle();
+    std::error_code error;
+    std::filesystem::resize_file(m_completePath, static_cast<std::uintmax_t>(length), error);
+    if (error) {
+        std::cerr << "Error truncating file: " << m_completePath << " " << error.message() << std::endl;
+    }
+    fileStream.clear();
+    open();
+    // the pages held may reach past the new end
+    m_pages.discard();
+    return !error;
+}
 
-    std::string line;
-    int i = 0;
-    
-    while (getNextLine(line, delim)) {
-       
-     
-        if (++i != lineNumber) lines.push_back(line);
-        else {
-            std::cout << "Line Skipped = " << line;
-        }
+bool fileIO::syncFile(const char* path) noexcept
+{
+#ifdef _WIN32
+    HANDLE handle = CreateFileA(path, GENERIC_WRITE, FILE_SHARE_READ | FILE_SHARE_WRITE, nullptr, OPEN_EXISTING, FILE_FLAG_BACKUP_SEMANTICS, nullptr);
+    if (handle == INVALID_HANDLE_VALUE) {
+        return false;
+    }
+    bool synced = FlushFileBuffers(handle) != 0;
+    CloseHandle(handle);
+    return synced;
+#else
+    int descriptor = ::open(path, O_RDONLY);
+    if (descriptor < 0) {
+        return false;
     }
+    bool synced = ::fsync(descriptor) == 0;
+    ::close(descriptor);
+    return synced;
+#endif
+}
 
-    for (const auto& l : lines) {
-        putLine(l.c_str());
+void* util::Arena::allocate(size_t size, size_t alignment)
+{
+    size_t padding = (alignment - reinterpret_cast<uintptr_t>(m_cursor) % alignment) % alignment;
+    if (m_cursor == nullptr || padding + size > m_remaining) {
+        // oversized requests get a block of their own
+        size_t blockSize = std::max(m_blockSize, size + alignment);
+        m_blocks.push_back(std::make_unique<char[]>(blockSize));
+        m_reserved += blockSize;
+        m_cursor = m_blocks.back().get();
+        m_remaining = blockSize;
+        padding = (alignment - reinterpret_cast<uintptr_t>(m_cursor) % alignment) % alignment;
     }
+    void* result = m_cursor + padding;
+    m_cursor += padding + size;
+    m_remaining -= padding + size;
+    return result;
 }
 
+std::string_view util::Arena::copy(std::string_view text)
+{
+    if (text.empty()) {
+        return std::string_view();
+    }
+    auto* destination = static_cast<char*>(allocate(text.size(), 1));
+    std::memcpy(destination, text.data(), text.size());
+    return std::string_view(destination, text.size());
+}
 
-bool fileIO::FileStream::overrideLine(size_t lineNumber, const char* newContent)
-{ // Check if the line number is valid
-    if (lineNumber == 0) {
-        std::cout << "Invalid line number." << std::endl;
-        return false;
+void util::Arena::absorb(Arena&& other)
+{
+    // the other arena's blocks are kept alive here, allocation continues in the current block
+    for (auto& block : other.m_blocks) {
+        m_blocks.push_back(std::move(block));
     }
+    m_reserved += other.m_reserved;
+    other.m_blocks.clear();
+    other.release();
+}
 
-    // Store the current position in the file
-    std::streampos originalPosition = fileStream.tellg();
+void util::Arena::release() noexcept
+{
+    m_blocks.clear();
+    m_cursor = nullptr;
+    m_remaining = 0;
+    m_reserved = 0;
+}
 
-    // Create a vector to store lines
-    std::vector<std::string> lines;
+util::ThreadPool::ThreadPool(size_t threadCount)
+{
+    for (size_t i = 0; i < std::max<size_t>(1, threadCount); i++) {
+        m_workers.emplace_back([this]() {
+            while (true) {
+                std::function<void()> task;
+                {
+                    std::unique_lock<std::mutex> guard(m_lock);
+                    m_wakeUp.wait(guard, [this]() { return m_stopping || !m_tasks.empty(); });
+                    if (m_tasks.empty()) {
+                        return;
+                    }
+                    task = std::move(m_tasks.front());
+                    m_tasks.pop();
+                }
+                task();
+            }
+        });
+    }
+}
 
-    // Read lines from the file into the vector
-    std::string line;
-    while (std::getline(fileStream, line)) {
-        lines.push_back(line);
+util::ThreadPool::~ThreadPool() noexcept
+{
+    {
+        std::lock_guard<std::mutex> guard(m_lock);
+        m_stopping = true;
+    }
+    m_wakeUp.notify_all();
+    for (auto& worker : m_workers) {
+        worker.join();
     }
+}
 
-    // Check if the line number is within bounds
-    if (lineNumber > lines.size()) {
-        std::cout << "Line number out of bounds." << std::endl;
-        // Restore the original position in the file
-        fileStream.seekg(originalPosition);
-        return false;
+std::future<void> util::ThreadPool::submit(std::function<void()> task)
+{
+    auto packaged = std::make_shared<std::packaged_task<void()>>(std::move(task));
+    auto future = packaged->get_future();
+    {
+        std::lock_guard<std::mutex> guard(m_lock);
+        m_tasks.emplace([packaged]() { (*packaged)(); });
     }
+    m_wakeUp.notify_one();
+    return future;
+}
 
-    // Modify the specified line
-    lines[lineNumber - 1] = newContent;
+util::ThreadPool& util::ThreadPool::shared()
+{
+    static ThreadPool pool(std::thread::hardware_concurrency());
+    return pool;
+}
 
-    // Clear the content of the file
-    fileStream.clear();
-    fileStream.seekp(0, std::ios::beg);
+fileIO::MappedFile::MappedFile(const char* path)
+{
+#ifdef _WIN32
+    HANDLE file = CreateFileA(path, GENERIC_READ, FILE_SHARE_READ | FILE_SHARE_WRITE | FILE_SHARE_DELETE, nullptr, OPEN_EXISTING, FILE_FLAG_SEQUENTIAL_SCAN, nullptr);
+    if (file == INVALID_HANDLE_VALUE) {
+        return;
+    }
+    LARGE_INTEGER fileSize;
+    if (!GetFileSizeEx(file, &fileSize)) {
+        CloseHandle(file);
+        return;
+    }
+    m_file = file;
+    m_size = static_cast<size_t>(fileSize.QuadPart);
+    m_open = true;
+    // empty files cannot be mapped, they are just an empty view
+    if (m_size == 0) {
+        return;
+    }
+    m_mapping = CreateFileMappingA(file, nullptr, PAGE_READONLY, 0, 0, nullptr);
+    if (m_mapping == nullptr) {
+        release();
+        return;
+    }
+    m_data = static_cast<const char*>(MapViewOfFile(m_mapping, FILE_MAP_READ, 0, 0, 0));
+    if (m_data == nullptr) {
+        release();
+    }
+#else
+    int descriptor = ::open(path, O_RDONLY);
+    if (descriptor < 0) {
+        return;
+    }
+    struct stat status;
+    if (::fstat(descriptor, &status) != 0) {
+        ::close(descriptor);
+        return;
+    }
+    m_size = static_cast<size_t>(status.st_size);
+    m_open = true;
+    if (m_size > 0) {
+        void* address = ::mmap(nullptr, m_size, PROT_READ, MAP_SHARED, descriptor, 0);
+        if (address == MAP_FAILED) {
+            m_size = 0;
+            m_open = false;
+        }
+        else {
+            // scans read front to back, let the kernel read ahead aggressively
+            ::madvise(address, m_size, MADV_SEQUENTIAL);
+            m_data = static_cast<const char*>(address);
+        }
+    }
+    // the mapping stays valid once the descriptor is closed
+    ::close(descriptor);
+#endif
+}
 
-    // Write the modified lines back to the file
-    for (const auto& modifiedLine : lines) {
-        fileStream << modifiedLine << std::endl;
+void fileIO::MappedFile::release() noexcept
+{
+#ifdef _WIN32
+    if (m_data != nullptr) {
+        UnmapViewOfFile(m_data);
     }
+    if (m_mapping != nullptr) {
+        CloseHandle(m_mapping);
+    }
+    if (m_file != nullptr) {
+        CloseHandle(m_file);
+    }
+    m_mapping = nullptr;
+    m_file = nullptr;
+#else
+    if (m_data != nullptr) {
+        ::munmap(const_cast<char*>(m_data), m_size);
+    }
+#endif
+    m_data = nullptr;
+    m_size = 0;
+    m_open = false;
+}
 
-    // Restore the original position in the file
-    fileStream.seekg(originalPosition);
+fileIO::MappedFile::~MappedFile() noexcept
+{
+    release();
+}
 
-    return true;
+fileIO::MappedFile::MappedFile(MappedFile&& other) noexcept
+{
+    *this = std::move(other);
 }
 
-void fileIO::FileStream::reopen()
+fileIO::MappedFile& fileIO::MappedFile::operator=(MappedFile&& other) noexcept
 {
-    fileStream.close();
-    fileStream.open(m_completePath);
+    if (this != &other) {
+        release();
+        std::swap(m_data, other.m_data);
+        std::swap(m_size, other.m_size);
+        std::swap(m_open, other.m_open);
+#ifdef _WIN32
+        std::swap(m_file, other.m_file);
+        std::swap(m_mapping, other.m_mapping);
+#endif
+    }
+    return *this;
+}
 
-    if (!fileStream.is_open()) {
-        std::cerr << "Error opening file: " << m_completePath << std::endl;
-        std::cerr << "Failbit: " << fileStream.fail() << " Badbit: " << fileStream.bad() << " Eofbit: " << fileStream.eof() << std::endl;
+fileIO::MappedFile fileIO::FileStream::map() const noexcept
+{
+    // the mapping reads the file, it has to hold what the pages still keep in memory
+    flush();
+    MappedFile mapped(m_completePath);
+    if (!mapped.is_open()) {
+        std::cerr << "Error mapping file: " << m_completePath << std::endl;
     }
-   
+    return mapped;
 }
 
 void fileIO::FileStream::moveCarreteToEnd() noexcept {
@@ -133,11 +646,12 @@ void fileIO::FileStream::moveCarreteToLine(size_t where) {
 
 void fileIO::FileStream::moveCarreteToBegin() noexcept {
    
+    fileStream.clear();
     fileStream.seekg(0, std::ios::beg);
-    std::cout <<"Current Position = " << fileStream.tellg();
 }
 
 void fileIO::FileStream::putLine(const char* formattedLine) noexcept {
+    m_writes++;
     fileStream << formattedLine;
 }
 
@@ -146,263 +660,3244 @@ const char* fileIO::FileStream::getTag() const noexcept
     return tag;
 }
 
-const char* fileIO::FileStream::getNextLine(std::string& dest, const char* delim) noexcept {
+const char* fileIO::FileStream::getNextLine(std::string& dest, const char*) noexcept {
     if (std::getline(fileStream, dest)) {
         return dest.c_str();
     }
-    else if (fileStream.eof() || fileStream.bad()) {
-        return nullptr;
-    }
-
-   
+    return nullptr;
 }
 
 std::string fileIO::FileStream::getFileContent()  noexcept {
+    flush();
     moveCarreteToBegin();
     std::stringstream buffer;
     buffer << fileStream.rdbuf();
     return buffer.str();
 }
 
+std::streamoff fileIO::FileStream::size() noexcept {
+    fileStream.clear();
+    fileStream.seekg(0, std::ios::end);
+    return fileStream.tellg();
+}
 
+size_t fileIO::FileStream::readDirect(std::streamoff offset, size_t length, char* dest) const noexcept {
+    size_t done = 0;
+#ifdef _WIN32
+    while (done < length) {
+        // the offset travels with the request, the handle's own position is never used
+        OVERLAPPED at{};
+        uint64_t position = static_cast<uint64_t>(offset) + done;
+        at.Offset = static_cast<DWORD>(position);
+        at.OffsetHigh = static_cast<DWORD>(position >> 32);
+        DWORD read = 0;
+        if (m_pageHandle == nullptr || !ReadFile(m_pageHandle, dest + done, static_cast<DWORD>(length - done), &read, &at) || read == 0) {
+            break;
+        }
+        done += read;
+    }
+#else
+    while (m_pageDescriptor >= 0 && done < length) {
+        ssize_t read = ::pread(m_pageDescriptor, dest + done, length - done, offset + static_cast<std::streamoff>(done));
+        if (read <= 0) {
+            break;
+        }
+        done += static_cast<size_t>(read);
+    }
+#endif
+    return done;
+}
 
+bool fileIO::FileStream::writeDirect(std::streamoff offset, const char* data, size_t length) const noexcept {
+    size_t done = 0;
+#ifdef _WIN32
+    while (done < length) {
+        OVERLAPPED at{};
+        uint64_t position = static_cast<uint64_t>(offset) + done;
+        at.Offset = static_cast<DWORD>(position);
+        at.OffsetHigh = static_cast<DWORD>(position >> 32);
+        DWORD written = 0;
+        if (m_pageHandle == nullptr || !WriteFile(m_pageHandle, data + done, static_cast<DWORD>(length - done), &written, &at) || written == 0) {
+            break;
+        }
+        done += written;
+    }
+#else
+    while (m_pageDescriptor >= 0 && done < length) {
+        ssize_t written = ::pwrite(m_pageDescriptor, data + done, length - done, offset + static_cast<std::streamoff>(done));
+        if (written <= 0) {
+            break;
+        }
+        done += static_cast<size_t>(written);
+    }
+#endif
+    return done == length;
+}
 
-
-table::Cursor::Cursor(fileIO::FileStream& fileStream, Serialization::Deserializer& deserializer, Serialization::Serializer& serializer, Serialization::FormatDescriptor& formatDescriptor)
-    : m_fileStream(fileStream), m_deserializer(deserializer), m_serializer(serializer), fd(formatDescriptor)
-{
-    int lineCount = 0;
-    std::string line;
-    while (m_fileStream.getNextLine(line, fd.getRowSeparator())) {
-        auto firstDelim = std::find(line.begin(), line.end(), fd.getColumnSeparator());
-        if (firstDelim != line.end()) {
-            m_mappedRows[line.substr(0, firstDelim - line.begin())] = lineCount++;
+bool fileIO::FileStream::readAt(std::streamoff offset, size_t length, std::string& dest) const noexcept {
+    dest.resize(length);
+    size_t done = 0;
+    while (done < length) {
+        uint64_t position = static_cast<uint64_t>(offset) + done;
+        auto page = m_pages.pin(position / PagePool::pageSize);
+        if (!page) {
+            // the pool is off, or every frame is pinned by other readers
+            done += readDirect(static_cast<std::streamoff>(position), length - done, dest.data() + done);
+            break;
+        }
+        size_t within = static_cast<size_t>(position % PagePool::pageSize);
+        if (within >= page.size()) {
+            break;
         }
+        size_t count = std::min(length - done, page.size() - within);
+        std::memcpy(dest.data() + done, page.data() + within, count);
+        done += count;
     }
+    dest.resize(done);
+    return done == length;
 }
 
-std::vector<std::string> table::Cursor::getPrimaryKeys()
+bool fileIO::FileStream::writeAt(std::streamoff offset, const char* data, size_t length) noexcept {
+    m_writes++;
+    if (m_pages.write(static_cast<uint64_t>(offset), data, length)) {
+        return true;
+    }
+    return writeDirect(offset, data, length);
+}
+
+std::streamoff fileIO::FileStream::append(const char* data, size_t length) noexcept {
+    m_writes++;
+    fileStream.clear();
+    fileStream.seekp(0, std::ios::end);
+    std::streamoff where = fileStream.tellp();
+    fileStream.write(data, length);
+    fileStream.flush();
+    // a resident last page takes the new bytes, the file already has them
+    m_pages.write(static_cast<uint64_t>(where), data, length);
+    return where;
+}
+
+bool fileIO::FileStream::flush() const noexcept {
+    return m_pages.flush();
+}
+
+void fileIO::FileStream::setPageBudget(size_t budgetBytes)
 {
-  //  auto kv = std::views::keys(m_mappedRows);
-  //  return std::vector<std::string>{kv.begin(), kv.end()};
-    return std::vector<std::string>();
+    m_pages.resize(budgetBytes);
 }
 
-bool table::Cursor::primaryKeyIsInside(const char* primaryKey) const noexcept
+fileIO::PagePool::Counters fileIO::FileStream::pageCounters() const
 {
-    return m_mappedRows.find(std::string(primaryKey)) != m_mappedRows.end();
+    return m_pages.counters();
 }
 
-std::vector<Serialization::Serializable*> table::Cursor::filterFields(const std::vector<size_t>& columnsIndexes, std::function<bool(const Serialization::Serializable*)> predicate) {
-    // Vector to store the filtered Serializable objects
-    std::vector<Serialization::Serializable*> result;
 
-    // String to store each line read from the file
-    std::string line;
 
-    m_fileStream.moveCarreteToBegin();
-    // Read lines from the file until the end
-    while (m_fileStream.getNextLine(line, fd.getRowSeparator())) {
-        // Deserialize the line into a vector of string fields
-        auto parsedFields = this->m_deserializer.deserialize(line.c_str(), &fd);
 
-        // Create a RowEntry object from the parsed fields
-        auto entry = Serialization::RowEntry(parsedFields);
 
-        // Check if the entry satisfies the predicate
-        if (predicate(&entry)) {
-            
-            // Build a new Serializable with the fields that are inside the columnsIndexes
-            std::vector<std::string> filteredFields;
-            if (columnsIndexes.size() == 0) {
-                filteredFields = parsedFields;
-            } 
-            else  for (auto index : columnsIndexes) {
-                // Check if the index is within bounds
-                if (index < parsedFields.size()) {
-                    filteredFields.push_back(parsedFields[index]);
-                   
-                }
-            }
+namespace {
 
-            // Create a new RowEntry with the filtered fields
-            Serialization::RowEntry* filteredEntry = new Serialization::RowEntry(filteredFields);
+    // key index layout: magic, table size, table modification time, checksum of the table's last bytes,
+    // key count, slot count, key bytes, the checksum of what follows and the hash the slots were placed with,
+    // then the slots and the keys of a KeyIndex as they were in memory
+    constexpr char keyIndexMagic[8] = { 'K', 'E', 'Y', 'I', 'N', 'D', 'X', '3' };
+    constexpr size_t keyIndexHeaderSize = sizeof(keyIndexMagic) + sizeof(uint64_t) * 8;
+    // names KeyIndex::hashOf, a change to it has to change this too or loaded slots would be probed in the wrong places
+    constexpr uint64_t keyIndexHash = 1;
+    // enough of the table's tail to notice a rewrite that kept its size and time
+    constexpr size_t stampedTail = 4096;
 
-            // Add the filtered entry to the result vector
-            result.push_back(filteredEntry);
+    // FNV-1a over 8 byte words, a key index runs to gigabytes and is summed on every open
+    uint64_t checksum(std::string_view data, uint64_t hash = 14695981039346656037ull) {
+        size_t i = 0;
+        for (; i + sizeof(uint64_t) <= data.size(); i += sizeof(uint64_t)) {
+            uint64_t word;
+            std::memcpy(&word, data.data() + i, sizeof(word));
+            hash = (hash ^ word) * 1099511628211ull;
         }
-        line.clear();
+        for (; i < data.size(); i++) {
+            hash = (hash ^ static_cast<unsigned char>(data[i])) * 1099511628211ull;
+        }
+        return hash;
     }
 
-    // Return the vector of filtered Serializable objects
-    return result;
-}
+    struct TableStamp {
+        uint64_t size = 0;
+        int64_t modified = 0;
+        uint64_t tail = 0;
+    };
 
-void table::Cursor::insertRows(std::vector<Serialization::Serializable*> content)
-{
-    this->m_fileStream.moveCarreteToEnd();
-    for (const auto& item : content) {
-        
-        bool keyCollision = this->primaryKeyIsInside(item->getPrimaryKey().c_str());
-        
-        if (keyCollision) {
-            std::cout << "Key collision for primary key = " << item->getPrimaryKey();
-            continue;
+    std::optional<TableStamp> stampTable(const fileIO::FileStream& stream, const char* path) {
+        std::error_code error;
+        TableStamp stamp;
+        stamp.size = std::filesystem::file_size(path, error);
+        if (error) {
+            return std::nullopt;
         }
-        else {
-                auto serialized = m_serializer.serialize(item, &fd);
-                //mapping the key to it' position in table
-                size_t index = m_mappedRows.size();
-                this->m_mappedRows[item->getPrimaryKey()] =index;
-                //writting the row into file stream
-                m_fileStream.putLine(serialized.c_str());
+        auto modified = std::filesystem::last_write_time(path, error);
+        if (error) {
+            return std::nullopt;
+        }
+        stamp.modified = static_cast<int64_t>(modified.time_since_epoch().count());
+        size_t length = static_cast<size_t>(std::min<uint64_t>(stamp.size, stampedTail));
+        std::string tail;
+        if (!stream.readAt(static_cast<std::streamoff>(stamp.size - length), length, tail)) {
+            return std::nullopt;
         }
-       
+        stamp.tail = checksum(tail);
+        return stamp;
     }
-    m_fileStream.moveCarreteToBegin();
 
-}
+    template<typename T>
+    void put(std::string& out, T value) {
+        out.append(reinterpret_cast<const char*>(&value), sizeof(T));
+    }
 
-void table::Cursor::updateRow(Serialization::Serializable* newItem)
-{
-    auto where = m_mappedRows.find(newItem->getPrimaryKey());
-    if (where == m_mappedRows.end()) {
-        std::cout << "Primary key not found" << newItem->getPrimaryKey() << "\n";
+    template<typename T>
+    T get(const char* data) {
+        T value;
+        std::memcpy(&value, data, sizeof(T));
+        return value;
     }
-    else {
-        auto serialized = m_serializer.serialize(newItem, &fd);
-        m_fileStream.overrideLine(m_mappedRows[newItem->getPrimaryKey()], serialized.c_str());
+
+}
+
+table::Cursor::Cursor(fileIO::FileStream& fileStream, Serialization::Deserializer& deserializer, Serialization::Serializer& serializer, Serialization::FormatDescriptor& formatDescriptor)
+    : m_fileStream(fileStream), m_deserializer(deserializer), m_serializer(serializer), fd(formatDescriptor)
+{
+    // an index saved against exactly this file spares reading every row
+    if (loadKeyIndex()) {
+        return;
+    }
+
+    std::streamoff offset = 0;
+    std::string_view line;
+    std::string scratch;
+    std::vector<std::string_view> fields;
+    std::string lastRow;
+    size_t framedEnd = 0;
+    bool complete = true;
+    std::vector<RowLocation> superseded;
+    {
+        auto mapped = m_fileStream.map();
+        auto rows = fd.rowReader(mapped.view());
+        while (rows.next(line, offset)) {
+            // a row owns its whole slot, framing and padding included
+            size_t length = rows.record().size();
+            lastRow.clear();
+            if (!m_deserializer.isTombstone(line, &fd)) {
+                m_deserializer.tokenize(line, &fd, fields, scratch);
+                // a binary row of no fields has the empty key, as RowView gives it
+                std::string_view key = fields.empty() ? std::string_view() : fields.front();
+                if (auto earlier = m_mappedRows.find(key)) {
+                    // replaced while a snapshot was open and never tombstoned, the later copy is the current one
+                    superseded.push_back(*earlier);
+                }
+                m_mappedRows.assign(key, RowLocation{ offset, length });
+                lastRow.assign(key);
+            }
+        }
+        framedEnd = rows.position();
+        complete = rows.complete();
+    }
+
+    for (const auto& location : superseded) {
+        auto tombstone = m_serializer.tombstone(location.length, &fd);
+        m_fileStream.writeAt(location.offset, tombstone.c_str(), tombstone.size());
+    }
+    if (!complete && fd.isLengthPrefixed()) {
+        // a binary row torn by a crash becomes dead space so appends land on a row boundary
+        auto dead = m_serializer.tombstone(static_cast<size_t>(m_fileStream.size()) - framedEnd, &fd);
+        m_fileStream.writeAt(framedEnd, dead.c_str(), dead.size());
+    }
+    else if (!complete) {
+        // the last row was written without a separator, terminate it so appends start on a new row
+        const char* rowSeparator = fd.getRowSeparator();
+        m_fileStream.append(rowSeparator, std::strlen(rowSeparator));
+        if (auto last = m_mappedRows.find(lastRow); last && !lastRow.empty()) {
+            m_mappedRows.assign(lastRow, RowLocation{ last->offset, last->length + std::strlen(rowSeparator) });
+        }
+    }
+    m_fileStream.flush();
+    m_writesSeen = m_fileStream.writeCount();
+}
+
+table::Cursor::~Cursor() noexcept
+{
+    // the copy that wrote last saves, the others leave the file alone
+    if (m_fileStream.writeCount() == m_writesSeen && m_keyIndexWrites->load() != m_writesSeen) {
+        saveKeyIndex();
+    }
+}
+
+std::string table::Cursor::keyIndexPath() const
+{
+    return std::string(m_fileStream.getPath()) + ".keys";
+}
+
+bool table::Cursor::loadKeyIndex()
+{
+    auto path = keyIndexPath();
+    if (!std::filesystem::exists(path)) {
+        return false;
+    }
+    fileIO::MappedFile mapped(path.c_str());
+    auto data = mapped.view();
+    auto stamp = stampTable(m_fileStream, m_fileStream.getPath());
+    if (!stamp || data.size() < keyIndexHeaderSize || data.substr(0, sizeof(keyIndexMagic)) != std::string_view(keyIndexMagic, sizeof(keyIndexMagic))) {
+        return false;
+    }
+    const char* header = data.data() + sizeof(keyIndexMagic);
+    auto body = data.substr(keyIndexHeaderSize);
+    if (get<uint64_t>(header) != stamp->size || get<int64_t>(header + 8) != stamp->modified || get<uint64_t>(header + 16) != stamp->tail
+        || get<uint64_t>(header + 48) != checksum(body) || get<uint64_t>(header + 56) != keyIndexHash) {
+        return false;
+    }
+    // the slots go back into memory as they are, nothing is hashed again
+    if (!m_mappedRows.load(body, get<uint64_t>(header + 24), get<uint64_t>(header + 32), get<uint64_t>(header + 40))) {
+        return false;
+    }
+    m_writesSeen = m_fileStream.writeCount();
+    m_keyIndexWrites->store(m_writesSeen);
+    return true;
+}
+
+bool table::Cursor::saveKeyIndex()
+{
+    std::unique_lock<std::mutex> order(m_writeLock);
+    m_turn.wait(order, [this]() { return m_appliedTickets == m_nextTicket; });
+    std::unique_lock<std::shared_mutex> writing(m_lock);
+
+    // another copy of the cursor wrote to the file, this key map no longer describes it and the file is left as it is
+    if (m_fileStream.writeCount() != m_writesSeen) {
+        return false;
+    }
+    if (m_keyIndexWrites->load() == m_writesSeen) {
+        return true;
+    }
+    // the stale copies of replaced rows must be dead before an open that skips the scan, so it never meets them
+    if (!m_superseded.empty()) {
+        if (m_snapshots.use_count() > 1) {
+            return false;
+        }
+        retireSuperseded();
+        m_writesSeen = m_fileStream.writeCount();
+    }
+    // the stamp has to see the file as it stays
+    if (!m_fileStream.flush()) {
+        return false;
+    }
+
+    auto stamp = stampTable(m_fileStream, m_fileStream.getPath());
+    if (!stamp) {
+        return false;
+    }
+    std::string header(keyIndexMagic, sizeof(keyIndexMagic));
+    put<uint64_t>(header, stamp->size);
+    put<int64_t>(header, stamp->modified);
+    put<uint64_t>(header, stamp->tail);
+    put<uint64_t>(header, m_mappedRows.size());
+    put<uint64_t>(header, m_mappedRows.capacity());
+    put<uint64_t>(header, m_mappedRows.keyBytes());
+    put<uint64_t>(header, m_mappedRows.checksum());
+    put<uint64_t>(header, keyIndexHash);
+
+    // a crash half way through leaves the old index, which the stamp then rejects
+    auto path = keyIndexPath();
+    auto partialPath = path + ".tmp";
+    {
+        std::ofstream out(partialPath, std::ios::binary | std::ios::trunc);
+        out << header;
+        m_mappedRows.save(out);
+        out.close();
+        if (out.fail()) {
+            std::cerr << "Error writing file: " << partialPath << std::endl;
+            return false;
+        }
+    }
+    std::error_code error;
+    std::filesystem::rename(partialPath, path, error);
+    if (error) {
+        std::cerr << "Error replacing file: " << path << " " << error.message() << std::endl;
+        return false;
+    }
+    m_keyIndexWrites->store(m_writesSeen);
+    return true;
+}
+
+table::Cursor::Cursor(const Cursor& other)
+    : m_fileStream(other.m_fileStream), m_deserializer(other.m_deserializer), m_serializer(other.m_serializer), fd(other.fd)
+{
+    std::shared_lock<std::shared_mutex> reading(other.m_lock);
+    m_mappedRows = other.m_mappedRows;
+    m_indexes = other.m_indexes;
+    m_log = other.m_log;
+    m_version = other.m_version.load();
+    m_superseded = other.m_superseded;
+    m_rowCache.resize(other.m_rowCache.capacity());
+    m_writesSeen = other.m_writesSeen;
+    m_keyIndexWrites = other.m_keyIndexWrites;
+    m_columnStore = other.m_columnStore;
+}
+
+table::Snapshot table::Cursor::snapshot() const
+{
+    std::shared_lock<std::shared_mutex> reading(m_lock);
+    std::vector<std::streamoff> superseded;
+    for (const auto& location : m_superseded) {
+        superseded.push_back(location.offset);
+    }
+    std::sort(superseded.begin(), superseded.end());
+    return Snapshot(m_fileStream.map(), std::move(superseded), m_snapshots);
+}
+
+std::vector<std::string> table::Cursor::getPrimaryKeys()
+{
+  //  auto kv = std::views::keys(m_mappedRows);
+  //  return std::vector<std::string>{kv.begin(), kv.end()};
+    return std::vector<std::string>();
+}
+
+bool table::Cursor::primaryKeyIsInside(const char* primaryKey) const noexcept
+{
+    std::shared_lock<std::shared_mutex> reading(m_lock);
+    return m_mappedRows.contains(primaryKey);
+}
+
+bool table::Cursor::readRow(const std::string& primaryKey, std::string& dest)
+{
+    std::shared_lock<std::shared_mutex> reading(m_lock);
+    return readCached(primaryKey, dest);
+}
+
+bool table::Cursor::readCached(std::string_view primaryKey, std::string& dest) const
+{
+    if (m_rowCache.get(primaryKey, dest)) {
+        return true;
+    }
+    if (!readSlot(primaryKey, dest)) {
+        return false;
+    }
+    m_rowCache.put(primaryKey, dest);
+    return true;
+}
+
+void table::Cursor::setRowCache(size_t capacityBytes)
+{
+    m_rowCache.resize(capacityBytes);
+}
+
+table::RowCache::Counters table::Cursor::rowCacheCounters() const
+{
+    return m_rowCache.counters();
+}
+
+bool table::Cursor::readSlot(std::string_view primaryKey, std::string& dest) const
+{
+    auto where = m_mappedRows.find(primaryKey);
+    if (!where) {
+        return false;
+    }
+    if (!m_fileStream.readAt(where->offset, where->length, dest)) {
+        return false;
     }
+    // a slot may carry padding after the row, keep only the row itself
+    std::string_view row;
+    std::streamoff offset;
+    auto rows = fd.rowReader(dest);
+    if (!rows.next(row, offset)) {
+        return false;
+    }
+    size_t start = row.data() - dest.data();
+    dest.resize(start + row.size());
+    dest.erase(0, start);
+    return true;
 }
 
-void table::Cursor::deleteRows(std::function<bool(const Serialization::Serializable*)> predicate)
+table::ResultSet table::Cursor::findByPrimaryKey(const std::string& primaryKey, const std::vector<size_t>& columnsIndexes)
 {
-    // String to store each line read from the file
+    ResultSet result;
     std::string line;
-    size_t lineIndex = 0;
-   
+    std::string scratch;
+    std::vector<std::string_view> parsedFields;
+    std::shared_lock<std::shared_mutex> reading(m_lock);
+    // one seek and one deserialize through the key index
+    if (readCached(primaryKey, line)) {
+        m_deserializer.tokenize(line, &fd, parsedFields, scratch);
+        result.add(parsedFields, columnsIndexes);
+    }
+    return result;
+}
 
-   
-    m_fileStream.reopen();  
-    m_fileStream.moveCarreteToBegin();
-    if (!m_fileStream.is_open() || m_fileStream.is_bad()) {
-        std::cerr << "Error opening file for reading: " << m_fileStream.getPath() << std::endl;
+table::ResultSet table::Cursor::findByKeys(const std::vector<std::string>& primaryKeys, const std::vector<size_t>& columnsIndexes, const std::function<bool(const Serialization::Serializable*)>& predicate)
+{
+    ResultSet result;
+    std::string line;
+    std::string scratch;
+    std::vector<std::string_view> parsedFields;
+    Serialization::RowView entry;
+    std::shared_lock<std::shared_mutex> reading(m_lock);
+    for (const auto& primaryKey : primaryKeys) {
+        if (!readCached(primaryKey, line)) {
+            continue;
+        }
+        m_deserializer.tokenize(line, &fd, parsedFields, scratch);
+        entry.reset(parsedFields);
+        if (predicate(&entry)) {
+            result.add(parsedFields, columnsIndexes);
+        }
+    }
+    return result;
+}
+
+void table::ResultSet::add(std::span<const std::string_view> fields, const std::vector<size_t>& columnsIndexes)
+{
+    size_t count = columnsIndexes.empty() ? fields.size() : columnsIndexes.size();
+    auto* views = static_cast<std::string_view*>(m_arena.allocate(sizeof(std::string_view) * std::max<size_t>(count, 1), alignof(std::string_view)));
+    size_t kept = 0;
+    if (columnsIndexes.empty()) {
+        for (const auto& field : fields) {
+            views[kept++] = m_arena.copy(field);
+        }
+    }
+    else for (auto index : columnsIndexes) {
+        // Check if the index is within bounds
+        if (index < fields.size()) {
+            views[kept++] = m_arena.copy(fields[index]);
+        }
+    }
+    m_rows.push_back(m_arena.make<Serialization::RowView>(std::span<const std::string_view>(views, kept)));
+}
+
+void table::ResultSet::absorb(ResultSet&& other)
+{
+    m_arena.absorb(std::move(other.m_arena));
+    m_rows.insert(m_rows.end(), other.m_rows.begin(), other.m_rows.end());
+    other.m_rows.clear();
+}
+
+static_assert(std::ranges::input_range<table::RowStream>);
+
+table::RowStream::RowStream(Snapshot&& snapshot, Serialization::Deserializer& deserializer, Serialization::FormatDescriptor& fd, std::function<bool(const Serialization::Serializable*)> predicate, std::vector<size_t> columnsIndexes, std::function<bool(std::string_view)> rowFilter)
+    : m_snapshot(std::move(snapshot)), m_rows(fd.rowReader(m_snapshot.view())), m_deserializer(&deserializer), m_fd(&fd), m_predicate(std::move(predicate)), m_rowFilter(std::move(rowFilter)), m_columns(std::move(columnsIndexes))
+{
+}
+
+table::RowStream::RowStream(RowStream&& other) noexcept
+    : m_snapshot(std::move(other.m_snapshot)), m_rows(other.m_rows), m_deserializer(other.m_deserializer), m_fd(other.m_fd), m_predicate(std::move(other.m_predicate)), m_rowFilter(std::move(other.m_rowFilter)), m_columns(std::move(other.m_columns))
+{
+    // the mapping keeps its address when moved, so the reader position carries over
+}
+
+table::RowStream::iterator table::RowStream::begin()
+{
+    advance();
+    return iterator(this);
+}
+
+void table::RowStream::advance()
+{
+    std::string_view line;
+    std::streamoff offset;
+    m_current = nullptr;
+    while (m_rows.next(line, offset)) {
+        if (m_deserializer->isTombstone(line, m_fd) || !m_snapshot.isLive(m_rows.record()) || (m_rowFilter && !m_rowFilter(line))) {
+            continue;
+        }
+
+        m_deserializer->tokenize(line, m_fd, m_fields, m_scratch);
+        m_row.reset(m_fields);
+        if (!m_predicate(&m_row)) {
+            continue;
+        }
+
+        if (!m_columns.empty()) {
+            // projecting only picks views, nothing is copied
+            m_projectedFields.clear();
+            for (auto index : m_columns) {
+                if (index < m_fields.size()) {
+                    m_projectedFields.push_back(m_fields[index]);
+                }
+            }
+            m_row.reset(m_projectedFields);
+        }
+        m_current = &m_row;
         return;
     }
+}
 
-      
+table::RowCache::Shard& table::RowCache::shardOf(std::string_view key) noexcept
+{
+    // the shard's map hashes the same key again, the top bits keep the two from lining up
+    return m_shards[(std::hash<std::string_view>()(key) >> 48) % shardCount];
+}
 
-    while (m_fileStream.getNextLine(line, fd.getRowSeparator()) != nullptr) {
-    
-        // Deserialize the line into a vector of string fields
-        auto parsedFields = this->m_deserializer.deserialize(line.c_str(), &fd);
+size_t table::RowCache::entryBytes(std::string_view key, std::string_view row) noexcept
+{
+    // the map node and its key string come on top of the bytes themselves
+    return key.size() + row.size() + sizeof(Entry) + sizeof(std::string) + 4 * sizeof(void*);
+}
 
-        // Create a RowEntry object from the parsed fields
-        auto entry = Serialization::RowEntry(parsedFields);
+void table::RowCache::remove(Shard& shard, size_t place)
+{
+    Entry& entry = shard.entries[place];
+    shard.bytes -= entryBytes(*entry.key, entry.row);
+    shard.places.erase(shard.places.find(*entry.key));
+    entry.key = nullptr;
+    std::string().swap(entry.row);
+    entry.referenced = false;
+    shard.freeEntries.push_back(place);
+}
 
-        // Check if the entry satisfies the predicate
-        if (predicate(&entry)) {
-            // Keep the line if it doesn't match the predicate
-            m_fileStream.deleteLine(lineIndex , fd.getRowSeparator());
-           
-            std::cout << "\nRemoved row with pk = " << entry.getPrimaryKey();
+void table::RowCache::resize(size_t capacityBytes)
+{
+    size_t previous = m_capacity.exchange(capacityBytes);
+    if (capacityBytes < previous) {
+        clear();
+    }
+}
+
+bool table::RowCache::get(std::string_view key, std::string& dest)
+{
+    if (m_capacity.load() == 0) {
+        return false;
+    }
+    Shard& shard = shardOf(key);
+    std::lock_guard<std::mutex> guard(shard.lock);
+    auto where = shard.places.find(key);
+    if (where == shard.places.end()) {
+        shard.counters.misses++;
+        return false;
+    }
+    Entry& entry = shard.entries[where->second];
+    entry.referenced = true;
+    dest.assign(entry.row);
+    shard.counters.hits++;
+    return true;
+}
+
+void table::RowCache::put(std::string_view key, std::string_view row)
+{
+    size_t bytes = entryBytes(key, row);
+    size_t shardCapacity = m_capacity.load() / shardCount;
+    if (bytes > shardCapacity) {
+        return;
+    }
+    Shard& shard = shardOf(key);
+    std::lock_guard<std::mutex> guard(shard.lock);
+    if (shard.places.find(key) != shard.places.end()) {
+        return;
+    }
+
+    // rows read once leave before rows read again, those get one more turn of the hand
+    while (shard.bytes + bytes > shardCapacity) {
+        Entry& entry = shard.entries[shard.hand];
+        if (entry.key != nullptr && entry.referenced) {
+            entry.referenced = false;
+        }
+        else if (entry.key != nullptr) {
+            remove(shard, shard.hand);
+            shard.counters.evictions++;
         }
-        
-       
-       
-        lineIndex++;
+        shard.hand = (shard.hand + 1) % shard.entries.size();
     }
-   
-    
 
+    size_t place = shard.entries.size();
+    if (!shard.freeEntries.empty()) {
+        place = shard.freeEntries.back();
+        shard.freeEntries.pop_back();
+    }
+    else {
+        shard.entries.emplace_back();
+    }
+    auto [where, inserted] = shard.places.emplace(std::string(key), place);
+    Entry& entry = shard.entries[place];
+    entry.key = &where->first;
+    entry.row.assign(row);
+    entry.referenced = false;
+    shard.bytes += bytes;
 }
 
-void Serialization::Serializer::sanitizeField( std::string& field , FormatDescriptor* fd)
+void table::RowCache::erase(std::string_view key)
 {
-    // Create a stringstream to build the sanitized field
-    std::stringstream ss;
+    if (m_capacity.load() == 0) {
+        return;
+    }
+    Shard& shard = shardOf(key);
+    std::lock_guard<std::mutex> guard(shard.lock);
+    auto where = shard.places.find(key);
+    if (where != shard.places.end()) {
+        remove(shard, where->second);
+    }
+}
 
-    // Start the result with a double quote
-  
+void table::RowCache::clear()
+{
+    for (auto& shard : m_shards) {
+        std::lock_guard<std::mutex> guard(shard.lock);
+        shard.places.clear();
+        shard.entries.clear();
+        shard.freeEntries.clear();
+        shard.hand = 0;
+        shard.bytes = 0;
+    }
+}
 
-    // Replace field and row separators with substitutes
-    field= util::ReplaceAll(field, std::string(fd->getColumnSeparator()),std::string( fd->getColumnSeparatorSubstitute()));
-     field = util::ReplaceAll(field, std::string(fd->getRowSeparator()),std::string( fd->getRowSeparatorSubstitute()));
+table::RowCache::Counters table::RowCache::counters() const
+{
+    Counters total;
+    for (const auto& shard : m_shards) {
+        std::lock_guard<std::mutex> guard(shard.lock);
+        total.hits += shard.counters.hits;
+        total.misses += shard.counters.misses;
+        total.evictions += shard.counters.evictions;
+        total.entries += shard.places.size();
+        total.bytes += shard.bytes;
+    }
+    return total;
+}
+
+uint32_t table::KeyIndex::hashOf(std::string_view key) noexcept
+{
+    // fixed rather than std::hash, whose values differ between standard libraries, the slots are saved as they were placed
+    uint64_t hash = ::checksum(key);
+    // the multiplies of FNV only carry low bits upwards, a final mix spreads the high ones back down
+    hash ^= hash >> 33;
+    hash *= 0xff51afd7ed558ccdull;
+    hash ^= hash >> 33;
+    auto folded = static_cast<uint32_t>(hash ^ (hash >> 32));
+    return folded == 0 ? 1 : folded;
+}
+
+std::string_view table::KeyIndex::keyAt(const Slot& slot) const noexcept
+{
+    size_t position = slot.keyOffset;
+    uint64_t length = 0;
+    fileIO::readVarint(m_keys, position, length);
+    return std::string_view(m_keys).substr(position, length);
+}
+
+size_t table::KeyIndex::probe(std::string_view key, uint32_t hash) const noexcept
+{
+    size_t mask = m_slots.size() - 1;
+    for (size_t at = hash & mask;; at = (at + 1) & mask) {
+        const Slot& slot = m_slots[at];
+        if (slot.hash == 0 || (slot.hash == hash && keyAt(slot) == key)) {
+            return at;
+        }
+    }
+}
+
+void table::KeyIndex::grow()
+{
+    // kept at most three quarters full so a probe for a missing key stays short
+    size_t capacity = std::max<size_t>(16, m_slots.size() * 2);
+    std::vector<Slot> slots(capacity);
+    size_t mask = capacity - 1;
+    for (const auto& slot : m_slots) {
+        if (slot.hash == 0) {
+            continue;
+        }
+        // keys are unique, the first empty slot is the one
+        size_t at = slot.hash & mask;
+        while (slots[at].hash != 0) {
+            at = (at + 1) & mask;
+        }
+        slots[at] = slot;
+    }
+    m_slots.swap(slots);
+}
+
+std::optional<table::RowLocation> table::KeyIndex::find(std::string_view key) const noexcept
+{
+    if (m_size == 0) {
+        return std::nullopt;
+    }
+    const Slot& slot = m_slots[probe(key, hashOf(key))];
+    if (slot.hash == 0) {
+        return std::nullopt;
+    }
+    return RowLocation{ static_cast<std::streamoff>(slot.rowOffset), slot.rowLength };
+}
+
+bool table::KeyIndex::insert(std::string_view key, RowLocation location)
+{
+    if ((m_size + 1) * 4 > m_slots.size() * 3) {
+        grow();
+    }
+    uint32_t hash = hashOf(key);
+    Slot& slot = m_slots[probe(key, hash)];
+    if (slot.hash != 0) {
+        return false;
+    }
+    slot = Slot{ static_cast<uint64_t>(location.offset), m_keys.size(), hash, static_cast<uint32_t>(location.length) };
+    fileIO::writeVarint(m_keys, key.size());
+    m_keys.append(key);
+    m_size++;
+    return true;
+}
+
+void table::KeyIndex::assign(std::string_view key, RowLocation location)
+{
+    if (m_size != 0) {
+        Slot& slot = m_slots[probe(key, hashOf(key))];
+        if (slot.hash != 0) {
+            slot.rowOffset = static_cast<uint64_t>(location.offset);
+            slot.rowLength = static_cast<uint32_t>(location.length);
+            return;
+        }
+    }
+    insert(key, location);
+}
+
+void table::KeyIndex::reserve(size_t count)
+{
+    while (count * 4 > m_slots.size() * 3) {
+        grow();
+    }
+}
+
+void table::KeyIndex::clear() noexcept
+{
+    std::fill(m_slots.begin(), m_slots.end(), Slot());
+    m_keys.clear();
+    m_size = 0;
+}
+
+void table::KeyIndex::swap(KeyIndex& other) noexcept
+{
+    m_slots.swap(other.m_slots);
+    m_keys.swap(other.m_keys);
+    std::swap(m_size, other.m_size);
+}
+
+void table::KeyIndex::save(std::ostream& out) const
+{
+    out.write(reinterpret_cast<const char*>(m_slots.data()), static_cast<std::streamsize>(m_slots.size() * sizeof(Slot)));
+    out.write(m_keys.data(), static_cast<std::streamsize>(m_keys.size()));
+}
+
+uint64_t table::KeyIndex::checksum() const noexcept
+{
+    auto slots = std::string_view(reinterpret_cast<const char*>(m_slots.data()), m_slots.size() * sizeof(Slot));
+    return ::checksum(m_keys, ::checksum(slots));
+}
+
+bool table::KeyIndex::load(std::string_view data, size_t count, size_t capacity, size_t keyBytes)
+{
+    if ((capacity & (capacity - 1)) != 0 || count * 4 > capacity * 3 || capacity > data.size() / sizeof(Slot) || data.size() - capacity * sizeof(Slot) != keyBytes) {
+        return false;
+    }
+    std::vector<Slot> slots(capacity);
+    std::memcpy(slots.data(), data.data(), capacity * sizeof(Slot));
+    size_t used = 0;
+    for (const auto& slot : slots) {
+        if (slot.hash != 0 && (++used > count || slot.keyOffset >= keyBytes)) {
+            return false;
+        }
+    }
+    if (used != count) {
+        return false;
+    }
+    m_slots.swap(slots);
+    m_keys.assign(data.substr(capacity * sizeof(Slot)));
+    // every key has to lie inside the buffer, a slot's key is read without further checks
+    for (const auto& slot : m_slots) {
+        size_t position = slot.keyOffset;
+        uint64_t length = 0;
+        if (slot.hash != 0 && (!fileIO::readVarint(m_keys, position, length) || length > m_keys.size() - position)) {
+            clear();
+            return false;
+        }
+    }
+    m_size = count;
+    return true;
+}
+
+void table::SecondaryIndex::add(const std::string& value, const std::string& primaryKey)
+{
+    if (m_kind == HASH) {
+        m_hashed.emplace(value, primaryKey);
+    }
+    else {
+        m_ordered.emplace(value, primaryKey);
+    }
+}
+
+void table::SecondaryIndex::remove(const std::string& value, const std::string& primaryKey)
+{
+    auto eraseFrom = [&](auto& container) {
+        auto [first, last] = container.equal_range(value);
+        for (auto it = first; it != last; ++it) {
+            if (it->second == primaryKey) {
+                container.erase(it);
+                return;
+            }
+        }
+    };
+    if (m_kind == HASH) {
+        eraseFrom(m_hashed);
+    }
+    else {
+        eraseFrom(m_ordered);
+    }
+}
+
+std::vector<std::string> table::SecondaryIndex::lookup(const std::string& value) const
+{
+    std::vector<std::string> keys;
+    auto collect = [&](const auto& container) {
+        auto [first, last] = container.equal_range(value);
+        for (auto it = first; it != last; ++it) {
+            keys.push_back(it->second);
+        }
+    };
+    if (m_kind == HASH) {
+        collect(m_hashed);
+    }
+    else {
+        collect(m_ordered);
+    }
+    return keys;
+}
+
+std::vector<std::string> table::SecondaryIndex::range(const std::string& from, const std::string& to) const
+{
+    std::vector<std::string> keys;
+    if (m_kind != ORDERED) {
+        return keys;
+    }
+    for (auto it = m_ordered.lower_bound(from); it != m_ordered.end() && it->first <= to; ++it) {
+        keys.push_back(it->second);
+    }
+    return keys;
+}
+
+void table::Cursor::indexRow(std::span<const std::string_view> fields, const std::string& primaryKey)
+{
+    for (auto& index : m_indexes) {
+        if (index.getColumn() < fields.size()) {
+            index.add(std::string(fields[index.getColumn()]), primaryKey);
+        }
+    }
+}
+
+void table::Cursor::unindexRow(std::span<const std::string_view> fields, const std::string& primaryKey)
+{
+    for (auto& index : m_indexes) {
+        if (index.getColumn() < fields.size()) {
+            index.remove(std::string(fields[index.getColumn()]), primaryKey);
+        }
+    }
+}
+
+bool table::Cursor::createIndex(size_t column, IndexKind kind)
+{
+    // no write may land between the build and the index going live, reads carry on meanwhile
+    std::unique_lock<std::mutex> order(m_writeLock);
+    m_turn.wait(order, [this]() { return m_appliedTickets == m_nextTicket; });
+    if (getIndex(column) != nullptr) {
+        return false;
+    }
+
+    SecondaryIndex index(column, kind);
+    std::string line;
+    {
+        std::shared_lock<std::shared_mutex> reading(m_lock);
+        // rows are read in file order, so the file is read front to back and equal values are indexed in the order a scan meets them
+        std::vector<std::pair<std::streamoff, std::string_view>> rows;
+        rows.reserve(m_mappedRows.size());
+        m_mappedRows.forEach([&](std::string_view primaryKey, RowLocation location) { rows.emplace_back(location.offset, primaryKey); });
+        std::sort(rows.begin(), rows.end());
+        for (const auto& [offset, primaryKey] : rows) {
+            if (!readSlot(primaryKey, line)) {
+                continue;
+            }
+            auto fields = m_deserializer.deserialize(line, &fd);
+            if (column < fields.size()) {
+                index.add(fields[column], std::string(primaryKey));
+            }
+        }
+    }
+    std::unique_lock<std::shared_mutex> writing(m_lock);
+    m_indexes.push_back(std::move(index));
+    return true;
+}
+
+const table::SecondaryIndex* table::Cursor::getIndex(size_t column) const noexcept
+{
+    for (const auto& index : m_indexes) {
+        if (index.getColumn() == column) {
+            return &index;
+        }
+    }
+    return nullptr;
+}
+
+size_t table::Cursor::rowCount() const
+{
+    std::shared_lock<std::shared_mutex> reading(m_lock);
+    return m_mappedRows.size();
+}
+
+size_t table::Cursor::keyIndexBytes() const
+{
+    std::shared_lock<std::shared_mutex> reading(m_lock);
+    return m_mappedRows.bytesReserved();
+}
+
+std::optional<std::vector<std::string>> table::Cursor::indexKeys(size_t column, const std::string& from, const std::string& to) const
+{
+    std::shared_lock<std::shared_mutex> reading(m_lock);
+    const SecondaryIndex* index = getIndex(column);
+    if (index == nullptr) {
+        return std::nullopt;
+    }
+    if (from == to) {
+        return index->lookup(from);
+    }
+    if (index->getKind() != ORDERED) {
+        return std::nullopt;
+    }
+    return index->range(from, to);
+}
+
+table::ResultSet table::Cursor::findByIndex(size_t column, const std::string& value, const std::vector<size_t>& columnsIndexes)
+{
+    ResultSet result;
+    std::shared_lock<std::shared_mutex> reading(m_lock);
+    const SecondaryIndex* index = getIndex(column);
+    if (index == nullptr) {
+        return result;
+    }
+
+    std::string line;
+    std::string scratch;
+    std::vector<std::string_view> parsedFields;
+    for (const auto& primaryKey : index->lookup(value)) {
+        if (!readCached(primaryKey, line)) {
+            continue;
+        }
+        m_deserializer.tokenize(line, &fd, parsedFields, scratch);
+        if (column < parsedFields.size() && parsedFields[column] == value) {
+            result.add(parsedFields, columnsIndexes);
+        }
+    }
+    return result;
+}
+
+std::optional<table::ResultSet> table::Cursor::findInOrder(size_t column, bool descending, size_t offset, std::optional<size_t> limit, const std::vector<size_t>& columnsIndexes, const std::function<bool(const Serialization::Serializable*)>& predicate)
+{
+    std::shared_lock<std::shared_mutex> reading(m_lock);
+    const SecondaryIndex* index = column == 0 ? nullptr : getIndex(column);
+    if (column != 0 && (index == nullptr || index->getKind() != ORDERED)) {
+        return std::nullopt;
+    }
+
+    ResultSet result;
+    std::string line;
+    std::string scratch;
+    std::vector<std::string_view> parsedFields;
+    Serialization::RowView entry;
+    size_t matched = 0;
+    // false once the limit is reached, rows after that are never read
+    auto visit = [&](std::string_view primaryKey) -> bool {
+        if (limit && result.size() >= *limit) {
+            return false;
+        }
+        if (!readCached(primaryKey, line)) {
+            return true;
+        }
+        m_deserializer.tokenize(line, &fd, parsedFields, scratch);
+        entry.reset(parsedFields);
+        if (predicate(&entry) && matched++ >= offset) {
+            result.add(parsedFields, columnsIndexes);
+        }
+        return true;
+    };
+    auto walk = [&](auto first, auto last, auto primaryKey) {
+        for (auto it = first; it != last && visit(primaryKey(*it)); ++it) {
+        }
+    };
+    if (column == 0) {
+        // the key map is unordered, keys are sorted a batch at a time and only as far as the rows handed back need
+        std::vector<std::string_view> keys;
+        keys.reserve(m_mappedRows.size());
+        m_mappedRows.forEach([&](std::string_view primaryKey, RowLocation) { keys.push_back(primaryKey); });
+        auto before = [descending](std::string_view left, std::string_view right) { return descending ? right < left : left < right; };
+        auto key = [](std::string_view primaryKey) { return primaryKey; };
+        size_t batch = limit ? std::max<size_t>(offset + *limit, 64) : keys.size();
+        for (size_t sorted = 0; sorted < keys.size() && (!limit || result.size() < *limit); batch *= 2) {
+            size_t end = std::min(keys.size(), sorted + batch);
+            std::partial_sort(keys.begin() + sorted, keys.begin() + end, keys.end(), before);
+            walk(keys.begin() + sorted, keys.begin() + end, key);
+            sorted = end;
+        }
+    }
+    else {
+        auto key = [](const auto& value) -> const std::string& { return value.second; };
+        const auto& ordered = index->ordered();
+        if (!descending) {
+            walk(ordered.begin(), ordered.end(), key);
+        }
+        // runs of equal values still come in the order they were indexed, as a sort would keep them
+        else for (auto last = ordered.end(); last != ordered.begin() && (!limit || result.size() < *limit);) {
+            auto first = ordered.lower_bound(std::prev(last)->first);
+            walk(first, last, key);
+            last = first;
+        }
+    }
+    return result;
+}
+
+void table::Cursor::filterRange(std::string_view data, const Snapshot& snapshot, const std::vector<size_t>& columnsIndexes, const std::function<bool(const Serialization::Serializable*)>& predicate, const std::function<bool(std::string_view)>& rowFilter, ResultSet& result)
+{
+    // Rows are read straight out of the mapped file
+    std::string_view line;
+    std::streamoff offset;
+    auto rows = fd.rowReader(data);
+
+    // Buffers reused by every row of the scan
+    std::string scratch;
+    std::vector<std::string_view> parsedFields;
+    Serialization::RowView entry;
+
+    // Read lines from the range until the end
+    while (rows.next(line, offset)) {
+        // Skip the dead space left behind by updates, and rows replaced before the snapshot was taken
+        if (m_deserializer.isTombstone(line, &fd) || !snapshot.isLive(rows.record())) {
+            continue;
+        }
+
+        // Rows the stored bytes already rule out are never split
+        if (rowFilter && !rowFilter(line)) {
+            continue;
+        }
+
+        // Split the line into fields, the predicate sees them without a copy
+        this->m_deserializer.tokenize(line, &fd, parsedFields, scratch);
+        entry.reset(parsedFields);
+
+        // Check if the entry satisfies the predicate
+        if (predicate(&entry)) {
+            // Only matching rows are copied, the fields inside columnsIndexes go into the result arena
+            result.add(parsedFields, columnsIndexes);
+        }
+    }
+}
+
+table::ResultSet table::Cursor::filterFields(const std::vector<size_t>& columnsIndexes, std::function<bool(const Serialization::Serializable*)> predicate, const std::function<bool(std::string_view)>& rowFilter) {
+    // Vector to store the filtered Serializable objects
+    ResultSet result;
+
+    auto snapshot = this->snapshot();
+    filterRange(snapshot.view(), snapshot, columnsIndexes, predicate, rowFilter, result);
+
+    // Return the vector of filtered Serializable objects
+    return result;
+}
+
+table::RowStream table::Cursor::streamRows(const std::vector<size_t>& columnsIndexes, std::function<bool(const Serialization::Serializable*)> predicate, std::function<bool(std::string_view)> rowFilter)
+{
+    return RowStream(snapshot(), m_deserializer, fd, std::move(predicate), columnsIndexes, std::move(rowFilter));
+}
+
+std::function<bool(std::string_view)> table::Cursor::equalityFilter(size_t column, std::string_view value) const
+{
+    return m_deserializer.equalityFilter(column, value, &fd);
+}
+
+table::ResultSet table::Cursor::filterFieldsParallel(const std::vector<size_t>& columnsIndexes, std::function<bool(const Serialization::Serializable*)> predicate, const query::ScanOptions& options, const std::function<bool(std::string_view)>& rowFilter)
+{
+    auto snapshot = this->snapshot();
+    return scanChunks(snapshot.view(), options, [&](std::string_view chunk, ResultSet& result) {
+        filterRange(chunk, snapshot, columnsIndexes, predicate, rowFilter, result);
+        });
+}
+
+table::ResultSet table::Cursor::scanChunks(std::string_view data, const query::ScanOptions& options, const std::function<void(std::string_view, ResultSet&)>& scanRange)
+{
+    auto& pool = util::ThreadPool::shared();
+    size_t threads = options.threads == 0 ? pool.size() : options.threads;
+
+    // A few chunks per thread evens out rows of uneven cost, tiny files are not worth splitting
+    constexpr size_t minimumChunk = 64 * 1024;
+    size_t chunkCount = std::max<size_t>(1, std::min(threads * 4, data.size() / minimumChunk));
+    if (threads <= 1 || chunkCount == 1) {
+        ResultSet result;
+        scanRange(data, result);
+        return result;
+    }
+
+    // Chunk boundaries are moved forward to the start of the next row
+    std::vector<size_t> boundaries{ 0 };
+    if (fd.isLengthPrefixed()) {
+        // a row start can't be found from the middle of binary rows, hop over the lengths instead
+        std::string_view line;
+        std::streamoff offset;
+        auto rows = fd.rowReader(data);
+        while (rows.next(line, offset) && boundaries.size() < chunkCount) {
+            if (static_cast<size_t>(offset) >= boundaries.size() * data.size() / chunkCount) {
+                boundaries.push_back(static_cast<size_t>(offset));
+            }
+        }
+    }
+    else {
+        const char rowSeparator = *fd.getRowSeparator();
+        for (size_t i = 1; i < chunkCount; i++) {
+            size_t boundary = data.find(rowSeparator, std::max(i * data.size() / chunkCount, boundaries.back()));
+            if (boundary == std::string_view::npos) {
+                break;
+            }
+            if (boundary + 1 > boundaries.back()) {
+                boundaries.push_back(boundary + 1);
+            }
+        }
+    }
+    boundaries.push_back(data.size());
+
+    size_t chunks = boundaries.size() - 1;
+    std::vector<ResultSet> partials(chunks);
+    ResultSet result;
+    std::mutex resultLock;
+    std::vector<std::future<void>> pending;
+    for (size_t i = 0; i < chunks; i++) {
+        std::string_view chunk = data.substr(boundaries[i], boundaries[i + 1] - boundaries[i]);
+        pending.push_back(pool.submit([&, i, chunk]() {
+            scanRange(chunk, partials[i]);
+            if (!options.preserveOrder) {
+                // merge as soon as the chunk is done
+                std::lock_guard<std::mutex> guard(resultLock);
+                result.absorb(std::move(partials[i]));
+            }
+        }));
+    }
+
+    // Every task refers to this frame, let all of them finish before an exception can unwind it
+    for (auto& task : pending) {
+        task.wait();
+    }
+    for (auto& task : pending) {
+        task.get();
+    }
+
+    if (options.preserveOrder) {
+        for (auto& partial : partials) {
+            result.absorb(std::move(partial));
+        }
+    }
+    return result;
+}
+
+table::ResultSet table::Cursor::filterFieldsBatch(const std::vector<size_t>& columnsIndexes, const query::CompiledExpression& expression, const query::ScanOptions& options, const std::function<bool(std::string_view)>& rowFilter)
+{
+    auto snapshot = this->snapshot();
+    return scanChunks(snapshot.view(), options, [&](std::string_view chunk, ResultSet& result) {
+        filterRangeBatch(chunk, snapshot, columnsIndexes, expression, rowFilter, result);
+        });
+}
+
+void table::Cursor::filterRangeBatch(std::string_view data, const Snapshot& snapshot, const std::vector<size_t>& columnsIndexes, const query::CompiledExpression& expression, const std::function<bool(std::string_view)>& rowFilter, ResultSet& result)
+{
+    std::string_view line;
+    std::streamoff offset;
+    auto rows = fd.rowReader(data);
+    std::string scratch;
+    std::vector<std::string_view> parsedFields;
+    query::Batch batch;
+    std::vector<uint8_t> selection;
+
+    auto flush = [&]() {
+        expression.evaluateBatch(batch, selection);
+        for (size_t i = 0; i < batch.size; i++) {
+            if (!selection[i]) {
+                continue;
+            }
+            // only the selected rows are split again and copied out
+            this->m_deserializer.tokenize(batch.rows[i], &fd, parsedFields, scratch);
+            result.add(parsedFields, columnsIndexes);
+        }
+        batch.clear();
+    };
+
+    // the block only gathers the columns the expression tests, the rest of each row is left unsplit
+    batch.reset(expression.columns());
+    std::vector<uint8_t> wanted(batch.slots.size());
+    for (auto column : batch.gathered) {
+        wanted[column] = 1;
+    }
+    while (rows.next(line, offset)) {
+        if (m_deserializer.isTombstone(line, &fd) || !snapshot.isLive(rows.record()) || (rowFilter && !rowFilter(line))) {
+            continue;
+        }
+        this->m_deserializer.tokenizeColumns(line, &fd, wanted, parsedFields, scratch);
+        // fields unescaped into scratch are moved to the block, the next row reuses scratch
+        batch.append(line, parsedFields, data);
+        if (batch.size == query::Batch::capacity) {
+            flush();
+        }
+    }
+    if (batch.size > 0) {
+        flush();
+    }
+}
+
+void table::Cursor::insertRows(std::vector<Serialization::Serializable*> content)
+{
+    // rows are serialized before any lock is taken
+    std::vector<std::pair<std::string, std::string>> rows;
+    for (const auto& item : content) {
+        rows.emplace_back(item->getPrimaryKey(), m_serializer.serialize(item, &fd));
+    }
+
+    std::unique_lock<std::mutex> order(m_writeLock);
+    std::vector<std::pair<std::string, std::string>> accepted;
+    {
+        // keys being inserted by writers still waiting for the log count as taken too
+        std::shared_lock<std::shared_mutex> reading(m_lock);
+        std::unordered_set<std::string> batchKeys;
+        for (auto& [primaryKey, serialized] : rows) {
+            bool keyCollision = m_mappedRows.contains(primaryKey) || m_pendingKeys.count(primaryKey) != 0 || !batchKeys.insert(primaryKey).second;
+
+            if (keyCollision) {
+                std::cout << "Key collision for primary key = " << primaryKey;
+                continue;
+            }
+            accepted.emplace_back(std::move(primaryKey), std::move(serialized));
+        }
+    }
+    uint64_t lastLsn = 0;
+    for (const auto& [primaryKey, serialized] : accepted) {
+        m_pendingKeys.insert(primaryKey);
+        if (m_log != nullptr) {
+            lastLsn = m_log->append(wal::INSERT, m_fileStream.getPath(), primaryKey, serialized);
+        }
+    }
+    uint64_t ticket = m_nextTicket++;
+
+    // the whole batch shares one log flush, with whatever other writers are waiting on it, and is only applied once it is durable
+    order.unlock();
+    bool durable = m_log == nullptr || lastLsn == 0 || m_log->waitDurable(lastLsn);
+    order.lock();
+    if (!durable) {
+        std::cerr << "Rows not inserted, the log could not be written" << std::endl;
+    }
+    applyInTurn(order, ticket, m_log != nullptr ? accepted.size() : 0, [&]() {
+        for (auto& [primaryKey, serialized] : accepted) {
+            if (durable) {
+                applyRow(primaryKey, std::move(serialized));
+            }
+            m_pendingKeys.erase(primaryKey);
+        }
+        });
+}
+
+table::BulkLoadResult table::Cursor::bulkLoad(const std::function<Serialization::Serializable*()>& next, const BulkLoadOptions& options)
+{
+    // like a delete the load has the table to itself among writers, readers carry on
+    std::unique_lock<std::mutex> order(m_writeLock);
+    m_turn.wait(order, [this]() { return m_appliedTickets == m_nextTicket; });
+
+    // rows of the buffer, placed relative to its start until it is written
+    std::string buffer;
+    buffer.reserve(options.bufferBytes);
+    std::vector<std::pair<std::string, RowLocation>> bufferedRows;
+    KeyIndex bufferedKeys;
+    std::string scratch;
+    std::vector<std::string_view> fields;
+    BulkLoadResult result;
+
+    auto flush = [&]() {
+        if (bufferedRows.empty()) {
+            return;
+        }
+        // the rows only become visible to readers once they are in the key map
+        auto end = m_fileStream.size();
+        auto start = m_fileStream.append(buffer.data(), buffer.size());
+        if (start < 0 || m_fileStream.is_bad()) {
+            std::cerr << "Error writing file: " << m_fileStream.getPath() << std::endl;
+            result.failed = true;
+            // no key points into what part of the buffer made it, it must not stay in the file
+            std::unique_lock<std::shared_mutex> writing(m_lock);
+            if (end >= 0) {
+                m_fileStream.truncate(end);
+            }
+            m_writesSeen = m_fileStream.writeCount();
+            return;
+        }
+        {
+            std::unique_lock<std::shared_mutex> writing(m_lock);
+            m_mappedRows.reserve(m_mappedRows.size() + bufferedRows.size());
+            for (auto& [primaryKey, location] : bufferedRows) {
+                if (!m_indexes.empty() || m_columnStore) {
+                    std::string_view line;
+                    std::streamoff offset;
+                    auto rows = fd.rowReader(std::string_view(buffer).substr(location.offset, location.length));
+                    if (rows.next(line, offset)) {
+                        m_deserializer.tokenize(line, &fd, fields, scratch);
+                        indexRow(fields, primaryKey);
+                        if (m_columnStore) {
+                            m_columnStore->append(fields, primaryKey);
+                        }
+                    }
+                }
+                m_mappedRows.insert(primaryKey, RowLocation{ start + location.offset, location.length });
+            }
+            m_writesSeen = m_fileStream.writeCount();
+            m_version++;
+        }
+        result.loaded += bufferedRows.size();
+        buffer.clear();
+        bufferedRows.clear();
+        bufferedKeys.clear();
+    };
+
+    while (!result.failed) {
+        auto* item = next();
+        if (item == nullptr) {
+            break;
+        }
+        // no other writer runs, so the key map is read without m_lock and a taken key costs no serialization
+        auto primaryKey = item->getPrimaryKey();
+        if (m_mappedRows.contains(primaryKey) || !bufferedKeys.insert(primaryKey, RowLocation{ 0, 0 })) {
+            if (options.reportCollisions) {
+                std::cout << "Key collision for primary key = " << primaryKey;
+            }
+            result.skipped++;
+            continue;
+        }
+        size_t offset = buffer.size();
+        m_serializer.serializeInto(buffer, item, &fd);
+        bufferedRows.emplace_back(std::move(primaryKey), RowLocation{ static_cast<std::streamoff>(offset), buffer.size() - offset });
+        if (buffer.size() >= options.bufferBytes) {
+            flush();
+        }
+    }
+    if (!result.failed) {
+        flush();
+    }
+
+    // nothing of the load is in the log, the table file itself has to hold it
+    if (options.sync && result.loaded != 0 && !fileIO::syncFile(m_fileStream.getPath())) {
+        std::cerr << "Error syncing file: " << m_fileStream.getPath() << std::endl;
+        result.failed = true;
+    }
+    return result;
+}
+
+table::BulkLoadResult table::Cursor::bulkLoad(const std::vector<Serialization::Serializable*>& content, const BulkLoadOptions& options)
+{
+    size_t position = 0;
+    return bulkLoad([&]() { return position < content.size() ? content[position++] : nullptr; }, options);
+}
+
+void table::Cursor::updateRow(Serialization::Serializable* newItem)
+{
+    auto primaryKey = newItem->getPrimaryKey();
+    auto serialized = m_serializer.serialize(newItem, &fd);
+
+    std::unique_lock<std::mutex> order(m_writeLock);
+    {
+        std::shared_lock<std::shared_mutex> reading(m_lock);
+        if (!m_mappedRows.contains(primaryKey) && m_pendingKeys.count(primaryKey) == 0) {
+            std::cout << "Primary key not found" << primaryKey << "\n";
+            return;
+        }
+    }
+    uint64_t lsn = m_log != nullptr ? m_log->append(wal::UPDATE, m_fileStream.getPath(), primaryKey, serialized) : 0;
+    uint64_t ticket = m_nextTicket++;
+
+    order.unlock();
+    bool durable = m_log == nullptr || m_log->waitDurable(lsn);
+    order.lock();
+    if (!durable) {
+        std::cerr << "Row not updated, the log could not be written" << std::endl;
+    }
+    applyInTurn(order, ticket, m_log != nullptr ? 1 : 0, [&]() {
+        if (durable) {
+            applyRow(primaryKey, std::move(serialized));
+        }
+        });
+}
+
+void table::Cursor::applyInTurn(std::unique_lock<std::mutex>& order, uint64_t ticket, size_t logged, const std::function<void()>& apply)
+{
+    // changes reach the table in log order, so a replay rebuilds exactly what readers saw
+    m_turn.wait(order, [&]() { return m_appliedTickets == ticket; });
+    {
+        std::unique_lock<std::shared_mutex> writing(m_lock);
+        apply();
+        // the group's writes to one page go back as one, and reach the file before the log may count them applied
+        m_fileStream.flush();
+        // any write, even a row rewritten in place, voids the key index file
+        m_writesSeen = m_fileStream.writeCount();
+    }
+    if (logged != 0) {
+        m_log->applied(logged);
+    }
+    m_appliedTickets++;
+    m_turn.notify_all();
+    // the log may only be emptied once nothing in it still waits to be applied
+    if (m_appliedTickets == m_nextTicket) {
+        checkpointIfDue();
+    }
+}
+
+void table::Cursor::applyRow(const std::string& primaryKey, std::string serialized)
+{
+    auto where = m_mappedRows.find(primaryKey);
+    m_version++;
+
+    // the old bytes of a row stay put while a snapshot may still be reading them
+    bool snapshotsOpen = m_snapshots.use_count() > 1;
+    if (!snapshotsOpen) {
+        retireSuperseded();
+    }
+
+    if (!m_indexes.empty() || m_columnStore) {
+        std::string scratch;
+        std::vector<std::string_view> fields;
+        if (where && !m_indexes.empty()) {
+            // the old values have to leave the secondary indexes
+            std::string oldLine;
+            if (readSlot(primaryKey, oldLine)) {
+                m_deserializer.tokenize(oldLine, &fd, fields, scratch);
+                unindexRow(fields, primaryKey);
+            }
+        }
+        std::string_view row;
+        std::streamoff offset;
+        auto rows = fd.rowReader(serialized);
+        if (rows.next(row, offset)) {
+            m_deserializer.tokenize(row, &fd, fields, scratch);
+            indexRow(fields, primaryKey);
+            if (m_columnStore) {
+                m_columnStore->append(fields, primaryKey);
+            }
+        }
+    }
+    m_rowCache.erase(primaryKey);
+
+    if (!where) {
+        //writting the row at the end of the file and mapping the key to it' position
+        auto offset = m_fileStream.append(serialized.c_str(), serialized.size());
+        m_mappedRows.assign(primaryKey, RowLocation{ offset, serialized.size() });
+        return;
+    }
+
+    RowLocation location = *where;
+    if (!snapshotsOpen && m_serializer.fitInto(serialized, location.length, &fd)) {
+        // the new row fits in the old slot, rewrite it in place
+        m_fileStream.writeAt(location.offset, serialized.c_str(), serialized.size());
+        return;
+    }
+
+    // too big for the slot, or still being read, kill the old row and append the new one
+    if (snapshotsOpen) {
+        m_superseded.push_back(location);
+    }
+    else {
+        auto tombstone = m_serializer.tombstone(location.length, &fd);
+        m_fileStream.writeAt(location.offset, tombstone.c_str(), tombstone.size());
+    }
+    auto offset = m_fileStream.append(serialized.c_str(), serialized.size());
+    m_mappedRows.assign(primaryKey, RowLocation{ offset, serialized.size() });
+}
+
+void table::Cursor::retireSuperseded()
+{
+    for (const auto& location : m_superseded) {
+        auto tombstone = m_serializer.tombstone(location.length, &fd);
+        m_fileStream.writeAt(location.offset, tombstone.c_str(), tombstone.size());
+    }
+    m_superseded.clear();
+}
+
+void table::Cursor::attachLog(wal::WriteAheadLog& log)
+{
+    std::unique_lock<std::mutex> order(m_writeLock);
+    m_turn.wait(order, [this]() { return m_appliedTickets == m_nextTicket; });
+    m_log = nullptr;
+    // redo everything the log holds, rewriting a row that is already there is harmless
+    auto records = log.attach(m_fileStream.getPath());
+    size_t next = 0;
+    while (next < records.size()) {
+        if (records[next].operation == wal::REMOVE) {
+            // a delete logs its keys one after the other, they leave the file in one pass as they did when it ran
+            std::unordered_set<std::string> removed;
+            for (; next < records.size() && records[next].operation == wal::REMOVE; next++) {
+                removed.insert(std::move(records[next].key));
+            }
+            removeRows([&](const Serialization::Serializable* row) { return removed.count(row->getPrimaryKey()) != 0; });
+            continue;
+        }
+        std::unique_lock<std::shared_mutex> writing(m_lock);
+        for (; next < records.size() && records[next].operation != wal::REMOVE; next++) {
+            applyRow(records[next].key, std::move(records[next].payload));
+        }
+        m_fileStream.flush();
+        m_writesSeen = m_fileStream.writeCount();
+    }
+    m_log = &log;
+    if (!records.empty()) {
+        checkpointLocked();
+    }
+}
+
+bool table::Cursor::attachColumnStore(std::shared_ptr<ColumnStore> store)
+{
+    // no write lands between filling the store and attaching it, so it misses none
+    std::unique_lock<std::mutex> order(m_writeLock);
+    m_turn.wait(order, [this]() { return m_appliedTickets == m_nextTicket; });
+    if (!store->load(*this) && !store->build(*this)) {
+        return false;
+    }
+    std::unique_lock<std::shared_mutex> writing(m_lock);
+    m_columnStore = std::move(store);
+    return true;
+}
+
+std::shared_ptr<table::ColumnStore> table::Cursor::columnStore() const
+{
+    std::shared_lock<std::shared_mutex> reading(m_lock);
+    return m_columnStore;
+}
+
+bool table::Cursor::checkpoint()
+{
+    std::unique_lock<std::mutex> order(m_writeLock);
+    m_turn.wait(order, [this]() { return m_appliedTickets == m_nextTicket; });
+    return checkpointLocked();
+}
+
+bool table::Cursor::checkpointLocked()
+{
+    if (m_log == nullptr) {
+        return false;
+    }
+    // every table writing to the log has to hold its logged rows durably before the log can go
+    auto applied = m_log->appliedCount();
+    for (const auto& path : m_log->scopes()) {
+        if (!fileIO::syncFile(path.c_str())) {
+            std::cerr << "Error syncing file: " << path << std::endl;
+            return false;
+        }
+    }
+    return m_log->truncate(applied);
+}
+
+void table::Cursor::checkpointIfDue()
+{
+    if (m_log != nullptr && m_log->size() >= m_log->getPolicy().checkpointBytes) {
+        checkpointLocked();
+    }
+}
+
+size_t table::Cursor::deleteRows(std::function<bool(const Serialization::Serializable*)> predicate)
+{
+    // Other writers wait until the file is replaced, readers carry on with the old one
+    std::unique_lock<std::mutex> order(m_writeLock);
+    m_turn.wait(order, [this]() { return m_appliedTickets == m_nextTicket; });
+    return removeRows(predicate);
+}
+
+size_t table::Cursor::removeRows(const std::function<bool(const Serialization::Serializable*)>& predicate)
+{
+    // Survivors are streamed into a side file that replaces the table in one rename
+    std::string survivorsPath = std::string(m_fileStream.getPath()) + ".tmp";
+    std::ofstream survivors(survivorsPath, std::ios::binary | std::ios::trunc);
+    if (!survivors.is_open()) {
+        std::cerr << "Error opening file for writing: " << survivorsPath << std::endl;
+        return 0;
+    }
+    // the column files are written anew alongside, with the survivors at their new positions
+    if (m_columnStore && !m_columnStore->beginRewrite()) {
+        survivors.close();
+        std::filesystem::remove(survivorsPath);
+        return 0;
+    }
+
+    // The key index is rebuilt for the new file in the same pass
+    KeyIndex keptRows;
+    std::vector<std::pair<std::string, std::vector<std::string>>> removedRows;
+    // the removed rows as they were, logged again should the file swap fail after the removal was logged
+    std::vector<std::string> removedSerialized;
+    std::streamoff offset = 0;
+    std::string_view line;
+    std::streamoff rowOffset;
+    std::string scratch;
+    std::vector<std::string_view> parsedFields;
+    Serialization::RowView entry;
+
+    // The snapshot must be gone before the file is replaced, rows replaced while snapshots were open are left behind
+    auto snapshot = std::make_unique<Snapshot>(this->snapshot());
+    auto rows = fd.rowReader(snapshot->view());
+    while (rows.next(line, rowOffset)) {
+        // Dead space is dropped, compacting the file as a side effect
+        if (m_deserializer.isTombstone(line, &fd) || !snapshot->isLive(rows.record())) {
+            continue;
+        }
+
+        // Split the line into fields, the predicate sees them without a copy
+        this->m_deserializer.tokenize(line, &fd, parsedFields, scratch);
+        entry.reset(parsedFields);
+
+        // Rows matching the predicate are simply not copied, they leave the indexes once the file is replaced
+        if (predicate(&entry)) {
+            if (!m_indexes.empty()) {
+                removedRows.emplace_back(entry.getPrimaryKey(), entry.getContent());
+            }
+            else {
+                removedRows.emplace_back(entry.getPrimaryKey(), std::vector<std::string>());
+            }
+            if (m_log != nullptr) {
+                removedSerialized.push_back(m_serializer.serialize(&entry, &fd));
+            }
+            continue;
+        }
+
+        // the open of the table made sure every row carries its framing
+        auto record = rows.record();
+        survivors << record;
+        size_t length = record.size();
+        keptRows.assign(parsedFields.empty() ? std::string_view() : parsedFields.front(), RowLocation{ offset, length });
+        offset += length;
+        if (m_columnStore) {
+            m_columnStore->rewriteRow(parsedFields);
+        }
+    }
+
+    snapshot.reset();
+    survivors.close();
+    if (survivors.fail()) {
+        std::cerr << "Error writing file: " << survivorsPath << std::endl;
+        std::filesystem::remove(survivorsPath);
+        if (m_columnStore) {
+            m_columnStore->endRewrite(false);
+        }
+        return 0;
+    }
+
+    if (removedRows.empty()) {
+        std::filesystem::remove(survivorsPath);
+        if (m_columnStore) {
+            m_columnStore->endRewrite(false);
+        }
+        return 0;
+    }
+
+    // The side file must be on disk before it takes the table's name
+    fileIO::syncFile(survivorsPath.c_str());
+
+    // the removal is logged before the file is replaced, a replay would bring the rows back from their INSERT records otherwise
+    if (m_log != nullptr) {
+        uint64_t lsn = 0;
+        for (const auto& [primaryKey, fields] : removedRows) {
+            lsn = m_log->append(wal::REMOVE, m_fileStream.getPath(), primaryKey, {});
+        }
+        if (!m_log->waitDurable(lsn)) {
+            std::cerr << "Rows not deleted, the log could not be written" << std::endl;
+            m_log->applied(removedRows.size());
+            std::filesystem::remove(survivorsPath);
+            if (m_columnStore) {
+                m_columnStore->endRewrite(false);
+            }
+            return 0;
+        }
+    }
+    {
+        std::unique_lock<std::shared_mutex> writing(m_lock);
+        if (!m_fileStream.replaceWith(survivorsPath)) {
+            if (m_columnStore) {
+                m_columnStore->endRewrite(false);
+            }
+            if (m_log != nullptr) {
+                // the rows are still in the table, logging them again undoes the removal for a replay
+                uint64_t lsn = 0;
+                for (size_t i = 0; i < removedRows.size(); i++) {
+                    lsn = m_log->append(wal::UPDATE, m_fileStream.getPath(), removedRows[i].first, removedSerialized[i]);
+                }
+                if (!m_log->waitDurable(lsn)) {
+                    std::cerr << "Error writing log, a replay removes rows the table still holds" << std::endl;
+                }
+                m_log->applied(removedRows.size() * 2);
+            }
+            return 0;
+        }
+        if (m_columnStore) {
+            m_columnStore->endRewrite(true);
+        }
+        m_mappedRows.swap(keptRows);
+        m_superseded.clear();
+        for (const auto& [primaryKey, fields] : removedRows) {
+            m_rowCache.erase(primaryKey);
+        }
+        m_writesSeen = m_fileStream.writeCount();
+        for (const auto& [primaryKey, fields] : removedRows) {
+            std::vector<std::string_view> views(fields.begin(), fields.end());
+            unindexRow(views, primaryKey);
+        }
+        m_version++;
+    }
+    if (m_log != nullptr) {
+        m_log->applied(removedRows.size());
+    }
+
+    // the new file is durable and holds every logged row, should another table keep the log from being emptied
+    // the REMOVE records repeat the delete on replay
+    checkpointLocked();
+    return removedRows.size();
+}
+
+void Serialization::Serializer::sanitizeField( std::string& field , FormatDescriptor* fd, bool leading)
+{
+    // Replace field and row separators with substitutes
+    field= util::ReplaceAll(field, std::string(fd->getColumnSeparator()),std::string( fd->getColumnSeparatorSubstitute()));
+     field = util::ReplaceAll(field, std::string(fd->getRowSeparator()),std::string( fd->getRowSeparatorSubstitute()));
+    if (leading && !field.empty() && field.front() == *fd->getTombstoneMarker()) {
+        field.replace(0, 1, fd->getTombstoneMarkerSubstitute());
+    }
+}
+
+
+std::string Serialization::Serializer::tombstone(size_t length, FormatDescriptor* fd)
+{
+    if (length == 0) {
+        return std::string();
+    }
+    // marker characters up to the row separator, a single byte slot is just an empty row
+    std::string dead(length - 1, *fd->getTombstoneMarker());
+    dead += fd->getRowSeparator();
+    return dead;
+}
+
+bool Serialization::Serializer::fitInto(std::string& record, size_t length, FormatDescriptor* fd)
+{
+    if (record.size() > length) {
+        return false;
+    }
+    record += tombstone(length - record.size(), fd);
+    return true;
+}
+
+std::string Serialization::Serializer::serialize(const Serializable* item, FormatDescriptor* fd)
+{
+    std::string record;
+    serializeInto(record, item, fd);
+    return record;
+}
+
+void Serialization::Serializer::serializeInto(std::string& out, const Serializable* item, FormatDescriptor* fd)
+{
+    // Get the vector from the Persistable object
+    auto vec = item->getContent();
+    std::string_view columnSeparator = fd->getColumnSeparator();
+    std::string_view rowSeparator = fd->getRowSeparator();
+    const char marker = *fd->getTombstoneMarker();
+
+    // Iterate over the vector and sanitize each field before appending it
+    for (auto iterator = vec.begin(); iterator != vec.end(); ++iterator) {
+        // most fields hold neither separator and are appended as they are
+        bool leading = iterator == vec.begin();
+        if (iterator->find(columnSeparator) != std::string::npos || iterator->find(rowSeparator) != std::string::npos ||
+            (leading && !iterator->empty() && iterator->front() == marker)) {
+            sanitizeField(*iterator, fd, leading);
+        }
+        if (*iterator != " ")
+            out += *iterator;
+
+        // Check if it's not the last element before adding a comma
+        if (std::next(iterator) != vec.cend()) {
+            out += ',';
+        }
+    }
+
+    // Append the row separator
+    out += rowSeparator;
+}
+
+void Serialization::Deserializer::removeSanitation(std::string& field , FormatDescriptor* fd)
+{
+   field = util::ReplaceAll(field, std::string(fd->getColumnSeparatorSubstitute()), std::string(fd->getColumnSeparator()));
+     field = util::ReplaceAll(field, std::string(fd->getRowSeparatorSubstitute()), std::string(fd->getRowSeparator()));
+
+    // Remove leading and trailing double quotes
+   
+}
+
+std::vector<std::string> Serialization::Deserializer::deserialize(std::string_view line, FormatDescriptor* fd)
+{
+    std::string scratch;
+    std::vector<std::string_view> fields;
+    tokenize(line, fd, fields, scratch);
+
+    // Copy the fields out of the tokenizer buffers
+    return std::vector<std::string>(fields.begin(), fields.end());
+}
+
+void Serialization::Deserializer::tokenize(std::string_view line, FormatDescriptor* fd, std::vector<std::string_view>& fields, std::string& scratch)
+{
+    tokenizeColumns(line, fd, {}, fields, scratch);
+}
+
+void Serialization::Deserializer::tokenizeColumns(std::string_view line, FormatDescriptor* fd, std::span<const uint8_t> wanted, std::vector<std::string_view>& fields, std::string& scratch)
+{
+    const char columnSeparator = *fd->getColumnSeparator();
+    const std::string_view columnSubstitute = fd->getColumnSeparatorSubstitute();
+    const std::string_view rowSubstitute = fd->getRowSeparatorSubstitute();
+    const std::string_view columnReplacement = fd->getColumnSeparator();
+    const std::string_view rowReplacement = fd->getRowSeparator();
+    const std::string_view markerSubstitute = fd->getTombstoneMarkerSubstitute();
+    const std::string_view markerReplacement = fd->getTombstoneMarker();
+
+    // Unescaped fields are written into scratch, which must not reallocate while views point into it
+    scratch.clear();
+    scratch.reserve(line.size() * std::max(columnReplacement.size(), rowReplacement.size()));
+    fields.clear();
+
+    auto unescape = [&](std::string_view raw, bool leading) -> std::string_view {
+        // Most fields carry no substitute at all and stay a view into the line
+        if (std::memchr(raw.data(), columnSubstitute.front(), raw.size()) == nullptr &&
+            std::memchr(raw.data(), rowSubstitute.front(), raw.size()) == nullptr &&
+            (!leading || std::memchr(raw.data(), markerSubstitute.front(), raw.size()) == nullptr)) {
+            return raw;
+        }
+        size_t start = scratch.size();
+        size_t i = 0;
+        if (leading && raw.compare(0, markerSubstitute.size(), markerSubstitute) == 0) {
+            scratch.append(markerReplacement);
+            i = markerSubstitute.size();
+        }
+        while (i < raw.size()) {
+            if (raw.compare(i, columnSubstitute.size(), columnSubstitute) == 0) {
+                scratch.append(columnReplacement);
+                i += columnSubstitute.size();
+            }
+            else if (raw.compare(i, rowSubstitute.size(), rowSubstitute) == 0) {
+                scratch.append(rowReplacement);
+                i += rowSubstitute.size();
+            }
+            else {
+                scratch.push_back(raw[i++]);
+            }
+        }
+        return std::string_view(scratch.data() + start, scratch.size() - start);
+    };
+
+    // memchr is vectorized by every mainstream libc
+    const char* position = line.data();
+    const char* end = line.data() + line.size();
+    while (true) {
+        auto separator = static_cast<const char*>(std::memchr(position, columnSeparator, end - position));
+        const char* fieldEnd = separator != nullptr ? separator : end;
+        std::string_view field(position, fieldEnd - position);
+        bool keep = wanted.empty() || wanted[fields.size()];
+        fields.push_back(keep ? unescape(field, fields.empty()) : std::string_view());
+        if (separator == nullptr || fields.size() == wanted.size()) {
+            break;
+        }
+        position = separator + 1;
+    }
+}
+
+bool Serialization::Deserializer::isTombstone(std::string_view line, FormatDescriptor* fd)
+{
+    // empty rows are dead space as well
+    return line.empty() || line.front() == *fd->getTombstoneMarker();
+}
+
+std::function<bool(std::string_view)> Serialization::Deserializer::equalityFilter(size_t column, std::string_view value, FormatDescriptor* fd)
+{
+    // a value with separators or substitutes in it only compares right once the row is unescaped
+    for (const char* special : { fd->getColumnSeparator(), fd->getRowSeparator(), fd->getColumnSeparatorSubstitute(), fd->getRowSeparatorSubstitute() }) {
+        if (value.find(*special) != std::string_view::npos) {
+            return {};
+        }
+    }
+    // a key starting with the marker is stored escaped
+    if (column == 0 && !value.empty() && value.front() == *fd->getTombstoneMarker()) {
+        return {};
+    }
+
+    // an escaped field holds a substitute the value lacks, so raw bytes and value differ just like the unescaped ones
+    return [column, value = std::string(value), columnSeparator = *fd->getColumnSeparator()](std::string_view line) -> bool {
+        const char* position = line.data();
+        const char* end = line.data() + line.size();
+        for (size_t i = 0; i < column; i++) {
+            auto separator = static_cast<const char*>(std::memchr(position, columnSeparator, end - position));
+            if (separator == nullptr) {
+                return false;
+            }
+            position = separator + 1;
+        }
+        auto separator = static_cast<const char*>(std::memchr(position, columnSeparator, end - position));
+        std::string_view field(position, (separator != nullptr ? separator : end) - position);
+        return field == value;
+    };
+}
+
+namespace {
+
+    // integers are zigzag encoded so small negative values stay short, the low bit of the tag tells them from text
+    bool encodeInteger(std::string_view field, uint64_t& tag) {
+        int64_t value = 0;
+        auto [end, error] = std::from_chars(field.data(), field.data() + field.size(), value);
+        if (error != std::errc() || end != field.data() + field.size()) {
+            return false;
+        }
+        // only the canonical spelling round trips, "007" or "-0" stay text
+        char canonical[24];
+        auto written = std::to_chars(canonical, canonical + sizeof(canonical), value).ptr;
+        if (std::string_view(canonical, written - canonical) != field) {
+            return false;
+        }
+        uint64_t zigzag = (static_cast<uint64_t>(value) << 1) ^ static_cast<uint64_t>(value >> 63);
+        if (zigzag >> 63) {
+            return false;
+        }
+        tag = (zigzag << 1) | 1;
+        return true;
+    }
+
+    // moves position past one encoded field
+    bool skipField(std::string_view row, size_t& position) {
+        uint64_t tag = 0;
+        if (!fileIO::readVarint(row, position, tag)) {
+            return false;
+        }
+        if ((tag & 1) == 0) {
+            if ((tag >> 1) > row.size() - position) {
+                return false;
+            }
+            position += tag >> 1;
+        }
+        return true;
+    }
+
+    // the varint width that lets a row header and its payload fill a slot exactly
+    size_t headerWidth(size_t slot, size_t payload) {
+        for (size_t width = 1; width <= 5 && width <= slot; width++) {
+            if (slot - width >= payload && fileIO::varintSize(slot - width) <= width) {
+                return width;
+            }
+        }
+        return 0;
+    }
+
+}
+
+void Serialization::BinarySerializer::encodeField(std::string& out, std::string_view field, ColumnType type)
+{
+    uint64_t tag = 0;
+    if (type == INTEGER && encodeInteger(field, tag)) {
+        fileIO::writeVarint(out, tag);
+        return;
+    }
+    fileIO::writeVarint(out, static_cast<uint64_t>(field.size()) << 1);
+    out.append(field);
+}
+
+void Serialization::BinarySerializer::serializeInto(std::string& out, const Serializable* item, FormatDescriptor* fd)
+{
+    auto content = item->getContent();
+    // the payload is encoded in place and its length put in front of it once known
+    size_t start = out.size();
+    fileIO::writeVarint(out, content.size() + 1);
+    for (size_t i = 0; i < content.size(); i++) {
+        encodeField(out, content[i], fd->getColumnType(i));
+    }
+
+    std::string header;
+    fileIO::writeVarint(header, out.size() - start);
+    out.insert(start, header);
+}
+
+std::string Serialization::BinarySerializer::tombstone(size_t length, FormatDescriptor*)
+{
+    if (length == 0) {
+        return std::string();
+    }
+    // a zero field count marks the row dead, the rest of the slot is padding
+    size_t width = headerWidth(length, 0);
+    std::string dead;
+    dead.reserve(length);
+    fileIO::writeVarint(dead, length - width, width);
+    dead.resize(length, '\0');
+    return dead;
+}
+
+bool Serialization::BinarySerializer::fitInto(std::string& record, size_t length, FormatDescriptor* fd)
+{
+    if (record.size() > length) {
+        return false;
+    }
+    std::string_view payload;
+    std::streamoff offset;
+    auto rows = fd->rowReader(record);
+    if (!rows.next(payload, offset)) {
+        return false;
+    }
+    size_t width = headerWidth(length, payload.size());
+    if (width == 0) {
+        return false;
+    }
+
+    // the padding goes inside the row, behind its last field
+    std::string padded;
+    padded.reserve(length);
+    fileIO::writeVarint(padded, length - width, width);
+    padded.append(payload);
+    padded.resize(length, '\0');
+    record.swap(padded);
+    return true;
+}
+
+void Serialization::BinaryDeserializer::tokenize(std::string_view line, FormatDescriptor* fd, std::vector<std::string_view>& fields, std::string& scratch)
+{
+    tokenizeColumns(line, fd, {}, fields, scratch);
+}
+
+void Serialization::BinaryDeserializer::tokenizeColumns(std::string_view line, FormatDescriptor*, std::span<const uint8_t> wanted, std::vector<std::string_view>& fields, std::string& scratch)
+{
+    fields.clear();
+    scratch.clear();
+    size_t position = 0;
+    uint64_t count = 0;
+    if (!fileIO::readVarint(line, position, count) || count == 0) {
+        return;
+    }
+    count--;
+
+    // integers are formatted into scratch, which must not reallocate while views point into it
+    scratch.reserve(std::min<uint64_t>(count, line.size()) * 20);
+    if (!wanted.empty()) {
+        count = std::min<uint64_t>(count, wanted.size());
+    }
+    for (uint64_t i = 0; i < count; i++) {
+        uint64_t tag = 0;
+        if (!fileIO::readVarint(line, position, tag)) {
+            return;
+        }
+        if (!wanted.empty() && !wanted[i]) {
+            // skipped without formatting the integer
+            uint64_t size = tag & 1 ? 0 : tag >> 1;
+            if (size > line.size() - position) {
+                return;
+            }
+            fields.push_back(std::string_view());
+            position += size;
+            continue;
+        }
+        if (tag & 1) {
+            uint64_t zigzag = tag >> 1;
+            auto value = static_cast<int64_t>((zigzag >> 1) ^ (~(zigzag & 1) + 1));
+            char digits[24];
+            auto written = std::to_chars(digits, digits + sizeof(digits), value).ptr;
+            size_t start = scratch.size();
+            scratch.append(digits, written);
+            fields.push_back(std::string_view(scratch.data() + start, scratch.size() - start));
+            continue;
+        }
+        uint64_t size = tag >> 1;
+        if (size > line.size() - position) {
+            return;
+        }
+        fields.push_back(line.substr(position, size));
+        position += size;
+    }
+}
+
+bool Serialization::BinaryDeserializer::isTombstone(std::string_view line, FormatDescriptor*)
+{
+    return line.empty() || line.front() == '\0';
+}
+
+std::function<bool(std::string_view)> Serialization::BinaryDeserializer::equalityFilter(size_t column, std::string_view value, FormatDescriptor* fd)
+{
+    // a value encodes to the same bytes it was stored with, so the fields compare without decoding
+    std::string encoded;
+    BinarySerializer::encodeField(encoded, value, fd->getColumnType(column));
+    return [column, encoded = std::move(encoded)](std::string_view line) -> bool {
+        size_t position = 0;
+        uint64_t count = 0;
+        if (!fileIO::readVarint(line, position, count) || count <= column + 1) {
+            return false;
+        }
+        for (size_t i = 0; i < column; i++) {
+            if (!skipField(line, position)) {
+                return false;
+            }
+        }
+        return line.compare(position, encoded.size(), encoded) == 0;
+    };
+}
+
+namespace {
+
+    bool parseNumber(std::string_view text, int64_t& value) noexcept {
+        // up to 18 digits can't overflow, those are summed up directly
+        bool negative = !text.empty() && text.front() == '-';
+        std::string_view digits = negative ? text.substr(1) : text;
+        if (!digits.empty() && digits.size() <= 18) {
+            int64_t result = 0;
+            for (char c : digits) {
+                unsigned digit = static_cast<unsigned char>(c) - '0';
+                if (digit > 9) {
+                    return false;
+                }
+                result = result * 10 + digit;
+            }
+            value = negative ? -result : result;
+            return true;
+        }
+        auto [end, error] = std::from_chars(text.data(), text.data() + text.size(), value);
+        return error == std::errc() && end == text.data() + text.size() && !text.empty();
+    }
+
+}
+
+bool query::CompiledExpression::parseKey(std::string_view field, Serialization::ColumnType type, int64_t& key) noexcept
+{
+    switch (type) {
+    case Serialization::INTEGER:
+        return parseNumber(field, key);
+    case Serialization::DATE: {
+        // year * 10000 + month * 100 + day orders like the calendar
+        auto first = field.find('-');
+        auto second = first == std::string_view::npos ? first : field.find('-', first + 1);
+        int64_t year = 0;
+        int64_t month = 0;
+        int64_t day = 0;
+        if (second == std::string_view::npos || !parseNumber(field.substr(0, first), year) ||
+            !parseNumber(field.substr(first + 1, second - first - 1), month) || !parseNumber(field.substr(second + 1), day)) {
+            return false;
+        }
+        if (year < 0 || year > 99999 || month < 1 || month > 12 || day < 1 || day > 31) {
+            return false;
+        }
+        key = year * 10000 + month * 100 + day;
+        return true;
+    }
+    case Serialization::DECIMAL: {
+        // millionths, so the comparison stays on integers
+        constexpr int64_t scale = 1000000;
+        bool negative = !field.empty() && field.front() == '-';
+        if (negative) {
+            field.remove_prefix(1);
+        }
+        auto point = field.find('.');
+        std::string_view whole = field.substr(0, point);
+        std::string_view fraction = point == std::string_view::npos ? std::string_view() : field.substr(point + 1);
+        int64_t units = 0;
+        if (whole.empty() || whole.front() == '-' || whole.front() == '+' || !parseNumber(whole, units) || units > INT64_MAX / scale - 1) {
+            return false;
+        }
+        if (point != std::string_view::npos && (fraction.empty() || fraction.size() > 6)) {
+            return false;
+        }
+        int64_t fractionValue = 0;
+        if (!fraction.empty()) {
+            if (fraction.front() == '-' || fraction.front() == '+' || !parseNumber(fraction, fractionValue)) {
+                return false;
+            }
+            for (size_t i = fraction.size(); i < 6; i++) {
+                fractionValue *= 10;
+            }
+        }
+        key = units * scale + fractionValue;
+        if (negative) {
+            key = -key;
+        }
+        return true;
+    }
+    default:
+        return false;
+    }
+}
+
+std::optional<query::CompiledExpression> query::CompiledExpression::compile(const Expression& expression, const std::vector<std::string>& columnNames, const std::vector<Serialization::ColumnType>& columnTypes)
+{
+    CompiledExpression compiled;
+    bool valid = true;
+    compiled.add(expression, columnNames, columnTypes, valid);
+    if (!valid) {
+        return std::nullopt;
+    }
+    return compiled;
+}
+
+size_t query::CompiledExpression::add(const Expression& expression, const std::vector<std::string>& columnNames, const std::vector<Serialization::ColumnType>& columnTypes, bool& valid)
+{
+    size_t index = m_nodes.size();
+    m_nodes.emplace_back();
+    m_nodes.back().kind = expression.kind;
+
+    if (expression.kind == Expression::AND || expression.kind == Expression::OR) {
+        // children are appended after their parent, so the root stays at 0
+        std::vector<size_t> children;
+        for (const auto& child : expression.children) {
+            children.push_back(add(child, columnNames, columnTypes, valid));
+        }
+        m_nodes[index].children = std::move(children);
+        return index;
+    }
+
+    auto column = std::find(columnNames.begin(), columnNames.end(), expression.column);
+    if (column == columnNames.end()) {
+        std::cout << "\nUnknown column " << expression.column << " in expression\n";
+        valid = false;
+        return index;
+    }
+
+    Node& node = m_nodes[index];
+    node.column = column - columnNames.begin();
+    node.type = node.column < columnTypes.size() ? columnTypes[node.column] : Serialization::TEXT;
+    node.lowText = expression.value;
+    node.highText = expression.kind == Expression::RANGE ? expression.upper : expression.value;
+    if (node.type == Serialization::TEXT) {
+        return index;
+    }
+
+    // typed comparisons all become low <= key <= high
+    int64_t value = 0;
+    int64_t upper = 0;
+    if (!parseKey(expression.value, node.type, value) || (expression.kind == Expression::RANGE && !parseKey(expression.upper, node.type, upper))) {
+        std::cout << "\nValue " << expression.value << " does not fit column " << expression.column << "\n";
+        valid = false;
+        return index;
+    }
+    node.low = INT64_MIN;
+    node.high = INT64_MAX;
+    switch (expression.kind) {
+    case Expression::EQ:
+        node.low = node.high = value;
+        break;
+    case Expression::LT:
+        // nothing is below the smallest key, the range is left empty
+        node.high = value - (value != INT64_MIN);
+        node.low = value != INT64_MIN ? INT64_MIN : INT64_MAX;
+        break;
+    case Expression::LE:
+        node.high = value;
+        break;
+    case Expression::GT:
+        // and nothing is above the largest
+        node.low = value + (value != INT64_MAX);
+        node.high = value != INT64_MAX ? INT64_MAX : INT64_MIN;
+        break;
+    case Expression::GE:
+        node.low = value;
+        break;
+    case Expression::RANGE:
+        node.low = value;
+        node.high = upper;
+        break;
+    default:
+        break;
+    }
+    return index;
+}
+
+bool query::CompiledExpression::evaluate(size_t index, std::span<const std::string_view> fields) const
+{
+    const Node& node = m_nodes[index];
+    switch (node.kind) {
+    case Expression::AND:
+        for (auto child : node.children) {
+            if (!evaluate(child, fields)) {
+                return false;
+            }
+        }
+        return true;
+    case Expression::OR:
+        for (auto child : node.children) {
+            if (evaluate(child, fields)) {
+                return true;
+            }
+        }
+        return false;
+    default:
+        break;
+    }
+
+    if (node.column >= fields.size()) {
+        return false;
+    }
+    std::string_view field = fields[node.column];
+    if (node.type != Serialization::TEXT) {
+        int64_t key = 0;
+        return parseKey(field, node.type, key) && node.low <= key && key <= node.high;
+    }
+    switch (node.kind) {
+    case Expression::EQ: return field == node.lowText;
+    case Expression::LT: return field < node.lowText;
+    case Expression::LE: return field <= node.lowText;
+    case Expression::GT: return field > node.lowText;
+    case Expression::GE: return field >= node.lowText;
+    case Expression::RANGE: return node.lowText <= field && field <= node.highText;
+    default: return false;
+    }
+}
+
+std::vector<size_t> query::CompiledExpression::columns() const
+{
+    std::vector<size_t> columns;
+    for (const auto& node : m_nodes) {
+        if (node.kind != Expression::AND && node.kind != Expression::OR && std::find(columns.begin(), columns.end(), node.column) == columns.end()) {
+            columns.push_back(node.column);
+        }
+    }
+    return columns;
+}
+
+void query::Batch::reset(const std::vector<size_t>& columns)
+{
+    gathered = columns;
+    slots.clear();
+    for (size_t slot = 0; slot < gathered.size(); slot++) {
+        if (gathered[slot] >= slots.size()) {
+            slots.resize(gathered[slot] + 1, std::string_view::npos);
+        }
+        slots[gathered[slot]] = slot;
+    }
+    this->columns.assign(gathered.size() * capacity, std::string_view());
+    present.assign(gathered.size() * capacity, 0);
+    rows.assign(capacity, std::string_view());
+    clear();
+}
+
+void query::Batch::clear() noexcept
+{
+    size = 0;
+    storage.release();
+}
+
+void query::Batch::append(std::string_view row, std::span<const std::string_view> fields, std::string_view data)
+{
+    rows[size] = row;
+    for (size_t slot = 0; slot < gathered.size(); slot++) {
+        size_t column = gathered[slot];
+        bool exists = column < fields.size();
+        std::string_view field = exists ? fields[column] : std::string_view();
+        if (!field.empty() && (field.data() < data.data() || field.data() >= data.data() + data.size())) {
+            // unescaped into the caller's scratch, which the next row overwrites
+            field = storage.copy(field);
+        }
+        columns[slot * capacity + size] = field;
+        present[slot * capacity + size] = exists;
+    }
+    size++;
+}
+
+void query::CompiledExpression::evaluateBatch(Batch& batch, std::vector<uint8_t>& selection) const
+{
+    // keys are parsed at most once per column per block, whichever node asks first
+    batch.keyed.assign(batch.gathered.size(), 0);
+    batch.keys.resize(batch.gathered.size() * Batch::capacity);
+    batch.parsed.resize(batch.gathered.size() * Batch::capacity);
+    batch.masks.resize(m_nodes.size());
+    selection.resize(Batch::capacity);
+    evaluateBatch(0, batch, selection.data(), nullptr, 1);
+}
+
+void query::CompiledExpression::evaluateBatch(size_t index, Batch& batch, uint8_t* selection, const uint8_t* active, uint8_t activeValue) const
+{
+    // rows where active[row] != activeValue are already settled by the parent, they are skipped and left at 0
+    const Node& node = m_nodes[index];
+    size_t size = batch.size;
+    if (node.kind == Expression::AND || node.kind == Expression::OR) {
+        bool isAnd = node.kind == Expression::AND;
+        evaluateBatch(node.children[0], batch, selection, active, activeValue);
+        for (size_t i = 1; i < node.children.size(); i++) {
+            // stop once the outcome of every row is settled
+            if (std::memchr(selection, isAnd ? 1 : 0, size) == nullptr) {
+                return;
+            }
+            auto& mask = batch.masks[node.children[i]];
+            mask.resize(Batch::capacity);
+            uint8_t* other = mask.data();
+            // the next operand only looks at the rows this one left open
+            evaluateBatch(node.children[i], batch, other, selection, isAnd ? 1 : 0);
+            // plain loops over byte masks, the compiler turns them into vector instructions
+            if (isAnd) {
+                for (size_t row = 0; row < size; row++) {
+                    selection[row] &= other[row];
+                }
+            }
+            else {
+                for (size_t row = 0; row < size; row++) {
+                    selection[row] |= other[row];
+                }
+            }
+        }
+        return;
+    }
+
+    size_t slot = node.column < batch.slots.size() ? batch.slots[node.column] : std::string_view::npos;
+    if (slot == std::string_view::npos) {
+        std::memset(selection, 0, size);
+        return;
+    }
+    const std::string_view* fields = batch.columns.data() + slot * Batch::capacity;
+    if (node.type != Serialization::TEXT) {
+        int64_t* keys = batch.keys.data() + slot * Batch::capacity;
+        uint8_t* parsed = batch.parsed.data() + slot * Batch::capacity;
+        int64_t low = node.low;
+        int64_t high = node.high;
+        if (!batch.keyed[slot] && active != nullptr) {
+            // only the open rows are worth parsing, the keys are not kept
+            for (size_t row = 0; row < size; row++) {
+                int64_t key = 0;
+                selection[row] = active[row] == activeValue && parseKey(fields[row], node.type, key) && low <= key && key <= high;
+            }
+            return;
+        }
+        if (!batch.keyed[slot]) {
+            // a missing field is empty and fails to parse like a malformed one
+            for (size_t row = 0; row < size; row++) {
+                int64_t key = 0;
+                parsed[row] = parseKey(fields[row], node.type, key);
+                keys[row] = key;
+            }
+            batch.keyed[slot] = 1;
+        }
+        for (size_t row = 0; row < size; row++) {
+            selection[row] = parsed[row] & (keys[row] >= low) & (keys[row] <= high);
+        }
+        return;
+    }
+
+    const uint8_t* present = batch.present.data() + slot * Batch::capacity;
+    std::string_view low = node.lowText;
+    std::string_view high = node.highText;
+    for (size_t row = 0; row < size; row++) {
+        std::string_view field = fields[row];
+        bool match = false;
+        if (present[row] && (active == nullptr || active[row] == activeValue)) {
+            switch (node.kind) {
+            case Expression::EQ: match = field == low; break;
+            case Expression::LT: match = field < low; break;
+            case Expression::LE: match = field <= low; break;
+            case Expression::GT: match = field > low; break;
+            case Expression::GE: match = field >= low; break;
+            case Expression::RANGE: match = low <= field && field <= high; break;
+            default: break;
+            }
+        }
+        selection[row] = match;
+    }
+}
+
+table::Table::Table(Cursor& cursor, std::vector<std::string> columnNames, const char* tableName, std::vector<Serialization::ColumnType> columnTypes)
+    :m_cursor(cursor) , m_columnNames(columnNames) , m_columnTypes(std::move(columnTypes)) , m_name(tableName)
+{
+    m_columnTypes.resize(m_columnNames.size(), Serialization::TEXT);
+}
+
+std::optional<size_t> table::Table::columnIndex(const std::string& columnName) const noexcept
+{
+    for (size_t i = 0; i < m_columnNames.size(); i++) {
+        if (m_columnNames[i] == columnName) {
+            return i;
+        }
+    }
+    return std::nullopt;
+}
+
+bool table::Table::resolvePredicate(query::Predicate& predicate) const
+{
+    if (predicate.expression) {
+        auto compiled = query::CompiledExpression::compile(*predicate.expression, m_columnNames, m_columnTypes);
+        if (!compiled) {
+            std::cout << "\nInvalid expression for TABLE " << this->m_name << "\n";
+            return false;
+        }
+        auto shared = std::make_shared<const query::CompiledExpression>(std::move(*compiled));
+        predicate.compiled = shared;
+        predicate.predicate = [shared](const Serialization::Serializable* obj) -> bool {
+            if (obj == nullptr) {
+                return false;
+            }
+            auto views = obj->getFieldViews();
+            if (!views.empty()) {
+                return shared->evaluate(views);
+            }
+            auto content = obj->getContent();
+            std::vector<std::string_view> fields(content.begin(), content.end());
+            return shared->evaluate(fields);
+        };
+        predicate.reads.emplace();
+        for (auto column : shared->columns()) {
+            predicate.reads->push_back(m_columnNames[column]);
+        }
+        // byte equality is only exact for text, typed columns may spell one value several ways
+        const auto& root = shared->root();
+        if (root.kind == query::Expression::EQ && root.type == Serialization::TEXT) {
+            predicate.rowFilter = m_cursor.equalityFilter(root.column, root.lowText);
+        }
+        return true;
+    }
+
+    if (!predicate.equality) {
+        return true;
+    }
+
+    auto column = columnIndex(predicate.equality->column);
+    if (!column) {
+        std::cout << "\nUnknown column " << predicate.equality->column << " in TABLE " << this->m_name << "\n";
+        return false;
+    }
+
+    // bind the equality to the column position for the paths that still scan
+    predicate.predicate = [index = *column, value = predicate.equality->value](const Serialization::Serializable* obj) -> bool {
+        if (obj == nullptr) {
+            return false;
+        }
+        auto views = obj->getFieldViews();
+        if (!views.empty()) {
+            return index < views.size() && views[index] == value;
+        }
+        auto fields = obj->getContent();
+        return index < fields.size() && fields[index] == value;
+    };
+    predicate.rowFilter = m_cursor.equalityFilter(*column, predicate.equality->value);
+    return true;
+}
+
+std::optional<std::vector<std::string>> table::Table::candidateKeys(const query::CompiledExpression& expression) const
+{
+    // the root itself, or any conjunct of a root AND, can narrow the rows down
+    std::vector<size_t> conjuncts{ 0 };
+    if (expression.root().kind == query::Expression::AND) {
+        conjuncts = expression.root().children;
+    }
+
+    for (auto index : conjuncts) {
+        const auto& node = expression.node(index);
+        // keys and indexes hold the stored text, a typed literal may be spelled differently ("7" and "07.0"), so only text equality can look it up
+        if (node.kind == query::Expression::EQ && node.type == Serialization::TEXT) {
+            if (node.column == 0) {
+                return std::vector<std::string>{ node.lowText };
+            }
+            if (auto keys = m_cursor.indexKeys(node.column, node.lowText, node.lowText)) {
+                return keys;
+            }
+        }
+        // ordered indexes sort bytes, which is the order of text columns only
+        if (node.kind == query::Expression::RANGE && node.type == Serialization::TEXT) {
+            if (auto keys = m_cursor.indexKeys(node.column, node.lowText, node.highText)) {
+                return keys;
+            }
+        }
+    }
+    return std::nullopt;
+}
+
+bool table::Table::createIndex(const std::string& columnName, IndexKind kind)
+{
+    auto column = columnIndex(columnName);
+    if (!column) {
+        std::cout << "\nUnknown column " << columnName << " in TABLE " << this->m_name << "\n";
+        return false;
+    }
+    return m_cursor.createIndex(*column, kind);
+}
+
+table::BulkLoadResult table::Table::bulkLoad(const std::function<Serialization::Serializable*()>& next, const BulkLoadOptions& options)
+{
+    return m_cursor.bulkLoad(next, options);
+}
+
+void table::Table::setRowCache(size_t capacityBytes)
+{
+    m_cursor.setRowCache(capacityBytes);
+}
+
+table::RowCache::Counters table::Table::rowCacheCounters() const
+{
+    return m_cursor.rowCacheCounters();
+}
+
+table::RowStream table::Table::executeStream(query::Query& query)
+{
+    std::vector<size_t> indexes;
+    for (size_t i = 0; i < m_columnNames.size(); i++) {
+        for (const auto& desiredField : query.target.labels) {
+            if (desiredField == m_columnNames[i])
+                indexes.push_back(i);
+        }
+    }
+
+    // an unknown column matches nothing
+    if (!resolvePredicate(query.predicate)) {
+        return m_cursor.streamRows(indexes, [](const Serialization::Serializable*) -> bool { return false; });
+    }
+    return m_cursor.streamRows(indexes, query.predicate.predicate, query.predicate.rowFilter);
+}
+
+bool table::Table::exists(query::Query& query)
+{
+    // key lookups never need the file scan
+    if (query.predicate.primaryKey) {
+        return m_cursor.primaryKeyIsInside(query.predicate.primaryKey->c_str());
+    }
+    auto rows = executeStream(query);
+    return rows.begin() != rows.end();
+}
+
+bool table::Table::createColumnStore()
+{
+    auto store = std::make_shared<ColumnStore>(m_cursor.getPath(), m_columnNames.size());
+    if (!m_cursor.attachColumnStore(std::move(store))) {
+        std::cout << "\nColumn store could not be built for TABLE " << this->m_name << "\n";
+        return false;
+    }
+    return true;
+}
+
+std::optional<table::ResultSet> table::Table::selectColumns(const std::vector<size_t>& columnsIndexes, const query::Predicate& predicate)
+{
+    auto store = m_cursor.columnStore();
+    if (!store || !predicate.reads) {
+        return std::nullopt;
+    }
+
+    // the projection, or every column when there is none, plus whatever the predicate reads
+    std::vector<bool> wanted(m_columnNames.size(), columnsIndexes.empty());
+    for (auto index : columnsIndexes) {
+        wanted[index] = true;
+    }
+    for (const auto& name : *predicate.reads) {
+        auto column = columnIndex(name);
+        if (!column) {
+            return std::nullopt;
+        }
+        wanted[*column] = true;
+    }
+    std::vector<size_t> neededColumns;
+    for (size_t i = 0; i < wanted.size(); i++) {
+        if (wanted[i]) {
+            neededColumns.push_back(i);
+        }
+    }
+
+    return store->scan(neededColumns, columnsIndexes, predicate.predicate);
+}
+
+std::optional<table::ResultSet> table::Table::join(query::Query& query)
+{
+    if (!query.join || query.join->inner == nullptr) {
+        std::cout << "\nNo table to JOIN with TABLE " << this->m_name << "\n";
+        return std::nullopt;
+    }
+    Table& inner = *query.join->inner;
+    auto column = columnIndex(query.join->column);
+    auto innerColumn = inner.columnIndex(query.join->innerColumn);
+    if (!column || !innerColumn) {
+        std::cout << "\nUnknown JOIN column " << query.join->column << " = " << query.join->innerColumn << "\n";
+        return std::nullopt;
+    }
+    auto projection = [](const Table& table, const std::vector<std::string>& labels) {
+        std::vector<size_t> indexes;
+        for (size_t i = 0; i < table.m_columnNames.size(); i++) {
+            if (labels.empty() || std::find(labels.begin(), labels.end(), table.m_columnNames[i]) != labels.end()) {
+                indexes.push_back(i);
+            }
+        }
+        return indexes;
+    };
+    auto outerIndexes = projection(*this, query.target.labels);
+    auto innerIndexes = projection(inner, query.join->innerLabels);
+
+    // both sides are compared as the typed one reads them, INTEGER against DECIMAL as DECIMAL
+    auto outerType = m_columnTypes[*column];
+    auto innerType = inner.m_columnTypes[*innerColumn];
+    auto type = outerType == Serialization::TEXT ? innerType : outerType;
+    if (innerType != Serialization::TEXT && innerType != type) {
+        bool numeric = (type == Serialization::INTEGER || type == Serialization::DECIMAL) && (innerType == Serialization::INTEGER || innerType == Serialization::DECIMAL);
+        if (!numeric) {
+            std::cout << "\nJOIN columns " << query.join->column << " and " << query.join->innerColumn << " hold different types\n";
+            return std::nullopt;
+        }
+        type = Serialization::DECIMAL;
+    }
+
+    // the outer rows come from an ordinary SELECT, so the key, the indexes and the column store still serve its predicate
+    query::Query select = query;
+    select.type = query::SELECT;
+    select.target.labels.clear();
+    select.join.reset();
+    auto outerRows = executeQuery(select);
+    if (!outerRows) {
+        return std::nullopt;
+    }
+    std::unordered_set<std::string_view> values;
+    for (const auto* row : *outerRows) {
+        auto fields = row->getFieldViews();
+        if (*column < fields.size()) {
+            values.insert(fields[*column]);
+        }
+    }
+
+    // a few values are looked up through the inner key or index, more than that and one scan of the inner table is cheaper
+    auto everyRow = [](const Serialization::Serializable*) -> bool { return true; };
+    std::optional<ResultSet> innerRows;
+    // keys and indexes hold the stored text, a typed value may be spelled differently on the inner side
+    if (type == Serialization::TEXT && values.size() <= inner.m_cursor.rowCount() / 4) {
+        std::vector<std::string> keys;
+        bool indexed = true;
+        for (const auto& value : values) {
+            if (*innerColumn == 0) {
+                keys.emplace_back(value);
+            }
+            else if (auto matching = inner.m_cursor.indexKeys(*innerColumn, std::string(value), std::string(value))) {
+                keys.insert(keys.end(), matching->begin(), matching->end());
+            }
+            else {
+                indexed = false;
+                break;
+            }
+        }
+        if (indexed) {
+            innerRows = inner.m_cursor.findByKeys(keys, {}, everyRow);
+        }
+    }
+    if (!innerRows) {
+        innerRows = inner.m_cursor.filterFields({}, everyRow);
+    }
+
+    // the inner rows are hashed on the join column and every outer row probes them
+    // a typed value goes in by what it reads as, one that doesn't read as the type is kept as text like the column type says
+    std::unordered_multimap<int64_t, const Serialization::RowView*> builtTyped;
+    std::unordered_multimap<std::string_view, const Serialization::RowView*> built;
+    if (type == Serialization::TEXT) {
+        built.reserve(innerRows->size());
+    }
+    else {
+        builtTyped.reserve(innerRows->size());
+    }
+    for (const auto* row : *innerRows) {
+        auto fields = row->getFieldViews();
+        if (*innerColumn >= fields.size()) {
+            continue;
+        }
+        int64_t key = 0;
+        if (type != Serialization::TEXT && query::CompiledExpression::parseKey(fields[*innerColumn], type, key)) {
+            builtTyped.emplace(key, row);
+        }
+        else {
+            built.emplace(fields[*innerColumn], row);
+        }
+    }
+
+    ResultSet result;
+    std::vector<std::string_view> joined;
+    for (const auto* row : *outerRows) {
+        auto outerFields = row->getFieldViews();
+        if (*column >= outerFields.size()) {
+            continue;
+        }
+        auto emit = [&](const Serialization::RowView* match) {
+            auto innerFields = match->getFieldViews();
+            joined.clear();
+            for (auto index : outerIndexes) {
+                joined.push_back(index < outerFields.size() ? outerFields[index] : std::string_view());
+            }
+            for (auto index : innerIndexes) {
+                joined.push_back(index < innerFields.size() ? innerFields[index] : std::string_view());
+            }
+            result.add(joined, {});
+        };
+        int64_t key = 0;
+        if (type != Serialization::TEXT && query::CompiledExpression::parseKey(outerFields[*column], type, key)) {
+            auto [first, last] = builtTyped.equal_range(key);
+            for (auto match = first; match != last; ++match) {
+                emit(match->second);
+            }
+            continue;
+        }
+        auto [first, last] = built.equal_range(outerFields[*column]);
+        for (auto match = first; match != last; ++match) {
+            emit(match->second);
+        }
+    }
+    return result;
+}
+
+namespace {
+
+    struct Accumulator {
+        int64_t count = 0;
+        // INTEGER and DECIMAL columns add up exactly, DECIMAL in millionths, until the sum leaves 64 bits and goes on in sum
+        int64_t exactSum = 0;
+        bool inexact = false;
+        double sum = 0;
+        bool hasExtreme = false;
+        int64_t extremeKey = 0;
+        std::string extreme;
+    };
+
+    // false, leaving sum as it was, when the result does not fit
+    bool addExact(int64_t& sum, int64_t value) noexcept {
+        if ((value > 0 && sum > INT64_MAX - value) || (value < 0 && sum < INT64_MIN - value)) {
+            return false;
+        }
+        sum += value;
+        return true;
+    }
+
+    std::string formatDouble(double value) {
+        char buffer[64];
+        auto [end, error] = std::to_chars(buffer, buffer + sizeof(buffer), value);
+        return error == std::errc() ? std::string(buffer, end) : std::to_string(value);
+    }
+
+    std::string formatDecimal(int64_t millionths) {
+        std::string text = millionths < 0 ? "-" : "";
+        uint64_t magnitude = millionths < 0 ? 0 - static_cast<uint64_t>(millionths) : static_cast<uint64_t>(millionths);
+        text += std::to_string(magnitude / 1000000);
+        std::string fraction = std::to_string(magnitude % 1000000);
+        fraction.insert(0, 6 - fraction.size(), '0');
+        while (!fraction.empty() && fraction.back() == '0') {
+            fraction.pop_back();
+        }
+        return fraction.empty() ? text : text + "." + fraction;
+    }
+
+}
+
+std::optional<table::ResultSet> table::Table::aggregate(query::Query& query)
+{
+    std::vector<size_t> groupColumns;
+    for (const auto& name : query.groupBy) {
+        auto column = columnIndex(name);
+        if (!column) {
+            std::cout << "\nUnknown GROUP BY column " << name << " in TABLE " << this->m_name << "\n";
+            return std::nullopt;
+        }
+        groupColumns.push_back(*column);
+    }
+    // an empty column means the row itself, it is only counted
+    std::vector<std::optional<size_t>> aggregateColumns;
+    for (const auto& aggregate : query.aggregates) {
+        if (aggregate.column.empty() && aggregate.function == query::Aggregate::COUNT) {
+            aggregateColumns.emplace_back();
+            continue;
+        }
+        auto column = columnIndex(aggregate.column);
+        if (!column) {
+            std::cout << "\nUnknown aggregate column " << aggregate.column << " in TABLE " << this->m_name << "\n";
+            return std::nullopt;
+        }
+        bool adds = aggregate.function == query::Aggregate::SUM || aggregate.function == query::Aggregate::AVG;
+        if (adds && m_columnTypes[*column] == Serialization::DATE) {
+            std::cout << "\nDATE column " << aggregate.column << " cannot be summed or averaged in TABLE " << this->m_name << "\n";
+            return std::nullopt;
+        }
+        aggregateColumns.emplace_back(*column);
+    }
+
+    // group g owns the values and accumulators at g * their count, groups keep the order their first row came in
+    size_t groupCount = 0;
+    std::vector<std::string> groupValues;
+    std::vector<Accumulator> accumulators;
+    std::unordered_map<std::string, size_t> slots;
+    std::string key;
+    for (const auto& row : m_cursor.streamRows({}, query.predicate.predicate, query.predicate.rowFilter)) {
+        auto fields = row.getFieldViews();
+
+        // the group values make up the hash key, a typed one by what it reads as and any other prefixed by its length
+        key.clear();
+        for (auto column : groupColumns) {
+            std::string_view value = column < fields.size() ? fields[column] : std::string_view();
+            int64_t typedKey = 0;
+            if (m_columnTypes[column] != Serialization::TEXT && query::CompiledExpression::parseKey(value, m_columnTypes[column], typedKey)) {
+                key.push_back('\1');
+                key.append(reinterpret_cast<const char*>(&typedKey), sizeof(typedKey));
+                continue;
+            }
+            key.push_back('\0');
+            fileIO::writeVarint(key, value.size());
+            key.append(value);
+        }
+        auto [slot, added] = slots.try_emplace(key, groupCount);
+        if (added) {
+            for (auto column : groupColumns) {
+                groupValues.emplace_back(column < fields.size() ? fields[column] : std::string_view());
+            }
+            accumulators.resize(accumulators.size() + query.aggregates.size());
+            groupCount++;
+        }
+
+        Accumulator* group = accumulators.data() + slot->second * query.aggregates.size();
+        for (size_t i = 0; i < query.aggregates.size(); i++) {
+            Accumulator& accumulator = group[i];
+            if (!aggregateColumns[i]) {
+                accumulator.count++;
+                continue;
+            }
+            size_t column = *aggregateColumns[i];
+            if (column >= fields.size() || fields[column].empty()) {
+                continue;
+            }
+            std::string_view value = fields[column];
+            auto type = m_columnTypes[column];
+            int64_t typedKey = 0;
+            bool typed = type != Serialization::TEXT;
+            if (typed && !query::CompiledExpression::parseKey(value, type, typedKey)) {
+                continue;
+            }
+
+            switch (query.aggregates[i].function) {
+            case query::Aggregate::COUNT:
+                accumulator.count++;
+                break;
+            case query::Aggregate::SUM:
+            case query::Aggregate::AVG: {
+                if (type == Serialization::INTEGER || type == Serialization::DECIMAL) {
+                    double scale = type == Serialization::DECIMAL ? 1000000 : 1;
+                    if (!accumulator.inexact && !addExact(accumulator.exactSum, typedKey)) {
+                        accumulator.inexact = true;
+                        accumulator.sum = static_cast<double>(accumulator.exactSum) / scale;
+                    }
+                    if (accumulator.inexact) {
+                        accumulator.sum += static_cast<double>(typedKey) / scale;
+                    }
+                }
+                else {
+                    // a TEXT column adds up the values that read as numbers, DATE columns were refused up front
+                    double number = 0;
+                    auto [end, error] = std::from_chars(value.data(), value.data() + value.size(), number);
+                    if (error != std::errc() || end != value.data() + value.size()) {
+                        continue;
+                    }
+                    accumulator.sum += number;
+                }
+                accumulator.count++;
+            }
+                break;
+            case query::Aggregate::MIN:
+            case query::Aggregate::MAX: {
+                bool wantsLower = query.aggregates[i].function == query::Aggregate::MIN;
+                bool better = !accumulator.hasExtreme ||
+                    (typed ? (wantsLower ? typedKey < accumulator.extremeKey : typedKey > accumulator.extremeKey)
+                        : (wantsLower ? value < accumulator.extreme : value > accumulator.extreme));
+                if (better) {
+                    accumulator.hasExtreme = true;
+                    accumulator.extremeKey = typedKey;
+                    accumulator.extreme.assign(value);
+                }
+                accumulator.count++;
+            }
+                break;
+            }
+        }
+    }
+
+    // without GROUP BY there is exactly one row, even over no rows at all
+    if (groupColumns.empty() && groupCount == 0) {
+        accumulators.resize(query.aggregates.size());
+        groupCount++;
+    }
 
-    // End the result with a double quote
-   
+    ResultSet result;
+    std::vector<std::string> values;
+    std::vector<std::string_view> views;
+    for (size_t g = 0; g < groupCount; g++) {
+        values.assign(groupValues.begin() + g * groupColumns.size(), groupValues.begin() + (g + 1) * groupColumns.size());
+        for (size_t i = 0; i < query.aggregates.size(); i++) {
+            const Accumulator& accumulator = accumulators[g * query.aggregates.size() + i];
+            auto type = aggregateColumns[i] ? m_columnTypes[*aggregateColumns[i]] : Serialization::INTEGER;
+            switch (query.aggregates[i].function) {
+            case query::Aggregate::COUNT:
+                values.push_back(std::to_string(accumulator.count));
+                break;
+            case query::Aggregate::SUM:
+                values.push_back(accumulator.inexact ? formatDouble(accumulator.sum)
+                    : type == Serialization::INTEGER ? std::to_string(accumulator.exactSum)
+                    : type == Serialization::DECIMAL ? formatDecimal(accumulator.exactSum) : formatDouble(accumulator.sum));
+                break;
+            case query::Aggregate::AVG: {
+                double total = accumulator.inexact ? accumulator.sum
+                    : type == Serialization::INTEGER ? static_cast<double>(accumulator.exactSum)
+                    : type == Serialization::DECIMAL ? static_cast<double>(accumulator.exactSum) / 1000000 : accumulator.sum;
+                values.push_back(accumulator.count == 0 ? std::string() : formatDouble(total / accumulator.count));
+            }
+                break;
+            case query::Aggregate::MIN:
+            case query::Aggregate::MAX:
+                values.push_back(accumulator.extreme);
+                break;
+            }
+        }
+        views.assign(values.begin(), values.end());
+        result.add(views, {});
+    }
+    return result;
 }
 
-
-std::string Serialization::Serializer::serialize(const Serializable* item, FormatDescriptor* fd)
+bool table::Table::narrowed(const query::Predicate& predicate) const
 {
-    // Create a stringstream to build the serialized object
-    std::stringstream ss;
+    if (predicate.primaryKey) {
+        return true;
+    }
+    if (predicate.equality) {
+        auto column = columnIndex(predicate.equality->column);
+        return column && (*column == 0 || m_cursor.indexKeys(*column, predicate.equality->value, predicate.equality->value));
+    }
+    return predicate.compiled && candidateKeys(*predicate.compiled);
+}
 
-    // Get the vector from the Persistable object
-    auto vec = item->getContent();
+namespace {
 
-    // Iterate over the vector and sanitize each field before appending to the stringstream
-    for (auto iterator = vec.begin(); iterator != vec.end(); ++iterator) {
-     sanitizeField(*iterator ,fd);
-        if (*iterator != " ")
-            ss << *iterator;
+    // where a row sorts, rows that tie keep the order they were read in
+    struct SortKey {
+        bool missing = false;
+        int64_t number = 0;
+        std::string_view text;
+        uint64_t sequence = 0;
+    };
 
-        // Check if it's not the last element before adding a comma
-        if (std::next(iterator) != vec.cend()) {
-            ss << ',';
+    SortKey sortKey(std::string_view value, Serialization::ColumnType type, uint64_t sequence) {
+        SortKey key;
+        key.sequence = sequence;
+        key.text = value;
+        if (type != Serialization::TEXT) {
+            key.missing = !query::CompiledExpression::parseKey(value, type, key.number);
         }
+        return key;
     }
 
-    // Append the row separator and print the serialized object to the console
-    ss << fd->getRowSeparator();
-   
+    // true when left is handed back before right
+    bool sortsBefore(const SortKey& left, const SortKey& right, Serialization::ColumnType type, bool descending) {
+        if (left.missing != right.missing) {
+            return right.missing;
+        }
+        if (!left.missing) {
+            int order = type == Serialization::TEXT ? left.text.compare(right.text) : (left.number < right.number ? -1 : left.number > right.number ? 1 : 0);
+            if (order != 0) {
+                return descending ? order > 0 : order < 0;
+            }
+        }
+        return left.sequence < right.sequence;
+    }
 
-    // Return the serialized object as a string
-    return ss.str();
 }
 
-void Serialization::Deserializer::removeSanitation(std::string& field , FormatDescriptor* fd)
+std::optional<table::ResultSet> table::Table::selectOrdered(query::Query& query, const std::vector<size_t>& columnsIndexes)
 {
-   field = util::ReplaceAll(field, std::string(fd->getColumnSeparatorSubstitute()), std::string(fd->getColumnSeparator()));
-     field = util::ReplaceAll(field, std::string(fd->getRowSeparatorSubstitute()), std::string(fd->getRowSeparator()));
-
-    // Remove leading and trailing double quotes
-   
-}
+    ResultSet result;
+    size_t wanted = query.limit ? query.offset + *query.limit : SIZE_MAX;
+    if (query.limit && *query.limit == 0) {
+        return result;
+    }
+    std::optional<size_t> column;
+    if (query.orderBy) {
+        column = columnIndex(query.orderBy->column);
+        if (!column) {
+            std::cout << "\nUnknown ORDER BY column " << query.orderBy->column << " in TABLE " << this->m_name << "\n";
+            return std::nullopt;
+        }
+    }
+    bool descending = query.orderBy && query.orderBy->descending;
 
-std::vector<std::string> Serialization::Deserializer::deserialize(const char* line, FormatDescriptor* fd)
-{
-    // Initialize variables for tokenization
-    size_t pos_start = 0, pos_end, delim_len = 1;
-    std::string token;
-    std::vector<std::string> res;
-    auto st = std::string(line);
-    // Tokenize the serialized object using field separator
-    while ((pos_end = st.find(std::string(fd->getColumnSeparator()), pos_start)) != std::string::npos) {
-        token = st.substr(pos_start, pos_end - pos_start);
-        pos_start = pos_end + delim_len;
-        removeSanitation(token, fd);
-        res.push_back(token);
+    // rows the key or an index picks are few, they are read as usual and sorted afterwards
+    if (narrowed(query.predicate)) {
+        query::Query select = query;
+        select.target.labels.clear();
+        select.orderBy.reset();
+        select.limit.reset();
+        auto rows = executeQuery(select);
+        if (!rows) {
+            return std::nullopt;
+        }
+        std::vector<std::pair<SortKey, const Serialization::RowView*>> sorted;
+        for (const auto* row : *rows) {
+            auto fields = row->getFieldViews();
+            std::string_view value = column && *column < fields.size() ? fields[*column] : std::string_view();
+            sorted.emplace_back(sortKey(value, column ? m_columnTypes[*column] : Serialization::TEXT, sorted.size()), row);
+        }
+        if (column) {
+            auto type = m_columnTypes[*column];
+            auto middle = sorted.begin() + std::min(wanted, sorted.size());
+            std::partial_sort(sorted.begin(), middle, sorted.end(), [&](const auto& left, const auto& right) { return sortsBefore(left.first, right.first, type, descending); });
+        }
+        for (size_t i = query.offset; i < std::min(wanted, sorted.size()); i++) {
+            result.add(sorted[i].second->getFieldViews(), columnsIndexes);
+        }
+        return result;
     }
 
-    // Add the last token after the last field separator
-    auto last = st.substr(pos_start);
-    removeSanitation(last, fd);
-    res.push_back(last);
+    // without ORDER BY the scan simply stops once the limit is reached
+    if (!column) {
+        size_t seen = 0;
+        for (const auto& row : m_cursor.streamRows(columnsIndexes, query.predicate.predicate, query.predicate.rowFilter)) {
+            if (seen++ < query.offset) {
+                continue;
+            }
+            result.add(row.getFieldViews(), {});
+            if (result.size() == *query.limit) {
+                break;
+            }
+        }
+        return result;
+    }
 
-    // Create a new Persistable object from the parsed fields
-    
-    return res;
-}
+    // byte order is the order of TEXT columns only, a walk over the keys or an ordered index stops at the limit
+    if (query.limit && m_columnTypes[*column] == Serialization::TEXT) {
+        if (auto walked = m_cursor.findInOrder(*column, descending, query.offset, query.limit, columnsIndexes, query.predicate.predicate)) {
+            return walked;
+        }
+    }
 
-table::Table::Table(Cursor& cursor, std::vector<std::string> columnNames, const char* tableName):m_cursor(cursor) , m_columnNames(columnNames) , m_name(tableName)
-{
+    // the heap keeps the best offset + limit rows seen so far with the worst on top, any row it rejects is never copied
+    struct Entry {
+        std::vector<std::string> fields;
+        SortKey key;
+    };
+    auto type = m_columnTypes[*column];
+    auto entryBefore = [&](const Entry& left, const Entry& right) { return sortsBefore(left.key, right.key, type, descending); };
+    std::vector<Entry> heap;
+    uint64_t sequence = 0;
+    for (const auto& row : m_cursor.streamRows({}, query.predicate.predicate, query.predicate.rowFilter)) {
+        auto fields = row.getFieldViews();
+        std::string_view value = *column < fields.size() ? fields[*column] : std::string_view();
+        SortKey key = sortKey(value, type, sequence++);
+        if (heap.size() == wanted) {
+            if (!sortsBefore(key, heap.front().key, type, descending)) {
+                continue;
+            }
+            // the evicted row's strings are reused for the new one
+            std::pop_heap(heap.begin(), heap.end(), entryBefore);
+        }
+        else {
+            heap.emplace_back();
+        }
+        Entry& entry = heap.back();
+        entry.fields.resize(fields.size());
+        for (size_t i = 0; i < fields.size(); i++) {
+            entry.fields[i].assign(fields[i]);
+        }
+        entry.key = key;
+        entry.key.text = *column < entry.fields.size() ? std::string_view(entry.fields[*column]) : std::string_view();
+        std::push_heap(heap.begin(), heap.end(), entryBefore);
+    }
 
+    std::sort_heap(heap.begin(), heap.end(), entryBefore);
+    std::vector<std::string_view> views;
+    for (size_t i = query.offset; i < heap.size(); i++) {
+        views.assign(heap[i].fields.begin(), heap[i].fields.end());
+        result.add(views, columnsIndexes);
+    }
+    return result;
 }
 
-std::optional<std::vector<Serialization::Serializable*>> table::Table::executeQuery(query::Query& query)
+std::optional<table::ResultSet> table::Table::executeQuery(query::Query& query)
 {
+    if (!resolvePredicate(query.predicate)) {
+        return std::nullopt;
+    }
+
     switch (query.type)
     {
     case query::SELECT: {
@@ -415,8 +3910,50 @@ std::optional<std::vector<Serialization::Serializable*>> table::Table::executeQu
             }
         }
 
+        // ORDER BY and LIMIT keep only the rows they hand back
+        if (query.orderBy || query.limit) {
+            return selectOrdered(query, indexes);
+        }
+
+        // Equality on the primary key is answered straight from the key index
+        if (query.predicate.primaryKey) {
+            return m_cursor.findByPrimaryKey(*query.predicate.primaryKey, indexes);
+        }
+
+        // Equality on an indexed column walks the index instead of the file
+        if (query.predicate.equality) {
+            auto column = *columnIndex(query.predicate.equality->column);
+            if (column == 0) {
+                return m_cursor.findByPrimaryKey(query.predicate.equality->value, indexes);
+            }
+            const auto& value = query.predicate.equality->value;
+            if (auto keys = m_cursor.indexKeys(column, value, value)) {
+                return m_cursor.findByKeys(*keys, indexes, query.predicate.predicate);
+            }
+        }
+
+        // A conjunct the key or an index answers narrows the rows, the whole expression still runs on them
+        if (query.predicate.compiled) {
+            if (auto keys = candidateKeys(*query.predicate.compiled)) {
+                return m_cursor.findByKeys(*keys, indexes, query.predicate.predicate);
+            }
+        }
+
+        // With a column store only the files of the touched columns are read
+        if (auto result = selectColumns(indexes, query.predicate)) {
+            return result;
+        }
+
+        // A compiled expression is tested a block of rows at a time
+        if (query.predicate.compiled) {
+            return m_cursor.filterFieldsBatch(indexes, *query.predicate.compiled, query.scan, query.predicate.rowFilter);
+        }
+
         // Filter fields based on columns indexes and predicate
-        auto result = m_cursor.filterFields(indexes, query.predicate.predicate);
+        if (query.scan.threads != 1) {
+            return m_cursor.filterFieldsParallel(indexes, query.predicate.predicate, query.scan, query.predicate.rowFilter);
+        }
+        auto result = m_cursor.filterFields(indexes, query.predicate.predicate, query.predicate.rowFilter);
         return result;
     }
                       break;
@@ -438,9 +3975,16 @@ std::optional<std::vector<Serialization::Serializable*>> table::Table::executeQu
         std::cout << "\nDELETE ";
 
         // Delete rows from the cursor based on the provided predicate
-        m_cursor.deleteRows(query.predicate.predicate);
+        auto removed = m_cursor.deleteRows(query.predicate.predicate);
+        std::cout << "\nRemoved " << removed << " rows";
     }
                       break;
+    case query::JOIN: {
+        return join(query);
+    }
+    case query::AGGREGATE: {
+        return aggregate(query);
+    }
     case query::INSERT: {
         if (query.payLoad.payLoad.empty()) {
             // Print a message if no payload is provided for INSERT
@@ -463,3 +4007,512 @@ std::optional<std::vector<Serialization::Serializable*>> table::Table::executeQu
     return std::nullopt;
 }
 
+std::string table::ColumnStore::columnPath(size_t column) const
+{
+    return m_basePath + ".col" + std::to_string(column);
+}
+
+std::string table::ColumnStore::manifestPath() const
+{
+    return m_basePath + ".columns";
+}
+
+std::string table::ColumnStore::sourceStamp(const char* sourcePath)
+{
+    std::error_code error;
+    auto size = std::filesystem::file_size(sourcePath, error);
+    if (error) {
+        return std::string();
+    }
+    auto modified = std::filesystem::last_write_time(sourcePath, error);
+    if (error) {
+        return std::string();
+    }
+    return std::to_string(size) + " " + std::to_string(modified.time_since_epoch().count());
+}
+
+bool table::ColumnStore::openFiles()
+{
+    m_files.clear();
+    for (size_t i = 0; i < m_columnCount; i++) {
+        m_files.emplace_back(columnPath(i), std::ios::binary | std::ios::app);
+        if (!m_files.back().is_open()) {
+            std::cerr << "Error opening file for writing: " << columnPath(i) << std::endl;
+            m_files.clear();
+            return false;
+        }
+    }
+    return true;
+}
+
+void table::ColumnStore::appendValues(std::vector<std::ofstream>& files, std::span<const std::string_view> fields)
+{
+    std::string length;
+    for (size_t i = 0; i < files.size(); i++) {
+        std::string_view value = i < fields.size() ? fields[i] : std::string_view();
+        length.clear();
+        fileIO::writeVarint(length, value.size());
+        files[i] << length << value;
+    }
+}
+
+table::ColumnStore::~ColumnStore()
+{
+    bool intact = !m_damaged && !m_files.empty();
+    for (auto& file : m_files) {
+        file.close();
+        intact = intact && !file.fail();
+    }
+    if (!intact) {
+        return;
+    }
+    // the stamp is taken once the cursors are done with the row file, any later change to it voids the columns
+    std::ofstream manifest(manifestPath(), std::ios::trunc);
+    manifest << m_columnCount << " " << m_live.size() << "\n" << sourceStamp(m_basePath.c_str()) << "\n";
+}
+
+bool table::ColumnStore::load(const Cursor& cursor)
+{
+    std::ifstream manifest(manifestPath());
+    size_t columnCount = 0;
+    size_t rowCount = 0;
+    std::string stamp;
+    if (!(manifest >> columnCount >> rowCount) || columnCount != m_columnCount) {
+        return false;
+    }
+    manifest >> std::ws;
+    std::getline(manifest, stamp);
+    if (stamp.empty() || stamp != sourceStamp(cursor.getPath())) {
+        return false;
+    }
+    for (size_t i = 0; i < m_columnCount; i++) {
+        if (!std::filesystem::exists(columnPath(i))) {
+            return false;
+        }
+    }
+
+    // the keys are the first column, the last position of a key is its current one
+    KeyIndex positions;
+    std::vector<bool> live;
+    {
+        fileIO::MappedFile keys(columnPath(0).c_str());
+        auto data = keys.view();
+        size_t position = 0;
+        for (size_t i = 0; i < rowCount; i++) {
+            uint64_t length = 0;
+            if (!fileIO::readVarint(data, position, length) || length > data.size() - position) {
+                return false;
+            }
+            auto key = data.substr(position, length);
+            position += length;
+            if (auto earlier = positions.find(key)) {
+                live[earlier->offset] = false;
+            }
+            positions.assign(key, RowLocation{ static_cast<std::streamoff>(i), 0 });
+            live.push_back(true);
+        }
+        if (position != data.size() || positions.size() != cursor.rowCount()) {
+            return false;
+        }
+    }
+
+    std::lock_guard<std::mutex> guard(m_lock);
+    if (!openFiles()) {
+        return false;
+    }
+    // the manifest comes back when the store closes, a crash in between leaves the files untrusted
+    std::error_code error;
+    std::filesystem::remove(manifestPath(), error);
+    m_positions.swap(positions);
+    m_live = std::move(live);
+    m_damaged = false;
+    return true;
+}
+
+bool table::ColumnStore::build(Cursor& cursor)
+{
+    std::error_code error;
+    std::filesystem::remove(manifestPath(), error);
+
+    std::vector<std::ofstream> files;
+    for (size_t i = 0; i < m_columnCount; i++) {
+        files.emplace_back(columnPath(i), std::ios::binary | std::ios::trunc);
+        if (!files.back().is_open()) {
+            std::cerr << "Error opening file for writing: " << columnPath(i) << std::endl;
+            return false;
+        }
+    }
+
+    // values are gathered per column and written in large pieces
+    constexpr size_t flushSize = 1 << 20;
+    std::vector<std::string> buffers(m_columnCount);
+    KeyIndex positions;
+    size_t rowCount = 0;
+    for (const auto& row : cursor.streamRows({}, [](const Serialization::Serializable*) -> bool { return true; })) {
+        auto fields = row.getFieldViews();
+        for (size_t i = 0; i < m_columnCount; i++) {
+            std::string_view value = i < fields.size() ? fields[i] : std::string_view();
+            fileIO::writeVarint(buffers[i], value.size());
+            buffers[i].append(value);
+            if (buffers[i].size() >= flushSize) {
+                files[i] << buffers[i];
+                buffers[i].clear();
+            }
+        }
+        positions.assign(fields.empty() ? std::string_view() : fields.front(), RowLocation{ static_cast<std::streamoff>(rowCount), 0 });
+        rowCount++;
+    }
+
+    for (size_t i = 0; i < m_columnCount; i++) {
+        files[i] << buffers[i];
+        files[i].close();
+        if (files[i].fail()) {
+            std::cerr << "Error writing file: " << columnPath(i) << std::endl;
+            return false;
+        }
+    }
+
+    std::lock_guard<std::mutex> guard(m_lock);
+    if (!openFiles()) {
+        return false;
+    }
+    m_positions.swap(positions);
+    m_live.assign(rowCount, true);
+    m_damaged = false;
+    return true;
+}
+
+void table::ColumnStore::append(std::span<const std::string_view> fields, std::string_view primaryKey)
+{
+    std::lock_guard<std::mutex> guard(m_lock);
+    // the old values stay in the files until the next delete writes them anew
+    if (auto earlier = m_positions.find(primaryKey)) {
+        m_live[earlier->offset] = false;
+    }
+    m_positions.assign(primaryKey, RowLocation{ static_cast<std::streamoff>(m_live.size()), 0 });
+    m_live.push_back(true);
+    appendValues(m_files, fields);
+}
+
+bool table::ColumnStore::beginRewrite()
+{
+    m_rewriteFiles.clear();
+    m_rewritePositions.clear();
+    m_rewriteCount = 0;
+    for (size_t i = 0; i < m_columnCount; i++) {
+        auto path = columnPath(i) + ".tmp";
+        m_rewriteFiles.emplace_back(path, std::ios::binary | std::ios::trunc);
+        if (!m_rewriteFiles.back().is_open()) {
+            std::cerr << "Error opening file for writing: " << path << std::endl;
+            endRewrite(false);
+            return false;
+        }
+    }
+    return true;
+}
+
+void table::ColumnStore::rewriteRow(std::span<const std::string_view> fields)
+{
+    m_rewritePositions.assign(fields.empty() ? std::string_view() : fields.front(), RowLocation{ static_cast<std::streamoff>(m_rewriteCount), 0 });
+    m_rewriteCount++;
+    appendValues(m_rewriteFiles, fields);
+}
+
+bool table::ColumnStore::endRewrite(bool keep)
+{
+    bool written = true;
+    for (auto& file : m_rewriteFiles) {
+        file.close();
+        written = written && !file.fail();
+    }
+    m_rewriteFiles.clear();
+    std::error_code error;
+    if (!keep || !written) {
+        for (size_t i = 0; i < m_columnCount; i++) {
+            std::filesystem::remove(columnPath(i) + ".tmp", error);
+        }
+        m_rewritePositions.clear();
+        if (keep) {
+            std::cerr << "Error writing column files of " << m_basePath << std::endl;
+            std::lock_guard<std::mutex> guard(m_lock);
+            m_damaged = true;
+        }
+        return written;
+    }
+
+    std::lock_guard<std::mutex> guard(m_lock);
+    m_files.clear();
+    for (size_t i = 0; i < m_columnCount; i++) {
+        std::filesystem::rename(columnPath(i) + ".tmp", columnPath(i), error);
+        if (error) {
+            std::cerr << "Error replacing file: " << columnPath(i) << " " << error.message() << std::endl;
+            m_damaged = true;
+            return false;
+        }
+    }
+    m_positions.swap(m_rewritePositions);
+    m_rewritePositions.clear();
+    m_live.assign(m_rewriteCount, true);
+    if (!openFiles()) {
+        m_damaged = true;
+        return false;
+    }
+    return true;
+}
+
+size_t table::ColumnStore::rowCount() const
+{
+    std::lock_guard<std::mutex> guard(m_lock);
+    return m_positions.size();
+}
+
+std::optional<table::ResultSet> table::ColumnStore::scan(const std::vector<size_t>& neededColumns, const std::vector<size_t>& columnsIndexes, const std::function<bool(const Serialization::Serializable*)>& predicate)
+{
+    // the positions written so far, later appends land past them and are not read
+    std::vector<bool> live;
+    std::vector<fileIO::MappedFile> files(m_columnCount);
+    std::vector<std::string_view> data(m_columnCount);
+    {
+        std::lock_guard<std::mutex> guard(m_lock);
+        for (auto& file : m_files) {
+            file.flush();
+            m_damaged = m_damaged || file.fail();
+        }
+        if (m_damaged || m_files.empty()) {
+            return std::nullopt;
+        }
+        live = m_live;
+        // mapped along with the copy of m_live, a delete that renames new files in afterwards leaves these mappings on the old ones
+        for (auto column : neededColumns) {
+            files[column] = fileIO::MappedFile(columnPath(column).c_str());
+            data[column] = files[column].view();
+        }
+    }
+
+    ResultSet result;
+    std::vector<size_t> positions(m_columnCount, 0);
+
+    // columns that are not read stay empty views
+    std::vector<std::string_view> fields(m_columnCount);
+    Serialization::RowView row;
+    for (size_t i = 0; i < live.size(); i++) {
+        for (auto column : neededColumns) {
+            uint64_t length = 0;
+            if (!fileIO::readVarint(data[column], positions[column], length) || length > data[column].size() - positions[column]) {
+                std::cerr << "Column file is damaged: " << columnPath(column) << std::endl;
+                return std::nullopt;
+            }
+            fields[column] = data[column].substr(positions[column], length);
+            positions[column] += length;
+        }
+        if (!live[i]) {
+            continue;
+        }
+
+        row.reset(fields);
+        if (predicate(&row)) {
+            result.add(fields, columnsIndexes);
+        }
+    }
+    return result;
+}
+
+void table::Transaction::insert(Table& table, Serialization::Serializable* row)
+{
+    Cursor& cursor = table.m_cursor;
+    m_writes.push_back(Write{ &cursor, wal::INSERT, row->getPrimaryKey(), cursor.m_serializer.serialize(row, &cursor.fd) });
+}
+
+void table::Transaction::update(Table& table, Serialization::Serializable* row)
+{
+    Cursor& cursor = table.m_cursor;
+    m_writes.push_back(Write{ &cursor, wal::UPDATE, row->getPrimaryKey(), cursor.m_serializer.serialize(row, &cursor.fd) });
+}
+
+bool table::Transaction::exists(Table& table, const std::string& primaryKey)
+{
+    Cursor& cursor = table.m_cursor;
+    for (const auto& write : m_writes) {
+        if (write.cursor == &cursor && write.primaryKey == primaryKey) {
+            return true;
+        }
+    }
+    bool present = false;
+    {
+        // a key logged for insertion and not applied yet is already taken
+        std::lock_guard<std::mutex> order(cursor.m_writeLock);
+        present = cursor.primaryKeyIsInside(primaryKey.c_str()) || cursor.m_pendingKeys.count(primaryKey) != 0;
+    }
+    m_expectations.push_back(Expectation{ &cursor, primaryKey, present });
+    return present;
+}
+
+bool table::Transaction::commit()
+{
+    if (m_finished) {
+        return false;
+    }
+    m_finished = true;
+
+    std::vector<Cursor*> writers;
+    for (const auto& write : m_writes) {
+        writers.push_back(write.cursor);
+    }
+    std::vector<Cursor*> cursors = writers;
+    for (const auto& expectation : m_expectations) {
+        cursors.push_back(expectation.cursor);
+    }
+    std::sort(writers.begin(), writers.end());
+    writers.erase(std::unique(writers.begin(), writers.end()), writers.end());
+    std::sort(cursors.begin(), cursors.end());
+    cursors.erase(std::unique(cursors.begin(), cursors.end()), cursors.end());
+
+    wal::WriteAheadLog* log = writers.empty() ? nullptr : writers.front()->m_log;
+    for (auto* cursor : writers) {
+        if (cursor->m_log != log) {
+            std::cerr << "Tables written by one transaction must share one log" << std::endl;
+            return false;
+        }
+    }
+
+    // the tables are locked in address order, so two transactions never wait on each other
+    std::vector<std::unique_lock<std::mutex>> orders;
+    for (auto* cursor : cursors) {
+        orders.emplace_back(cursor->m_writeLock);
+    }
+
+    // what the transaction read must still hold, and every write must still be possible
+    for (const auto& expectation : m_expectations) {
+        std::shared_lock<std::shared_mutex> reading(expectation.cursor->m_lock);
+        bool present = expectation.cursor->m_mappedRows.contains(expectation.primaryKey) || expectation.cursor->m_pendingKeys.count(expectation.primaryKey) != 0;
+        if (present != expectation.present) {
+            std::cerr << "Transaction aborted, primary key " << expectation.primaryKey << " changed" << std::endl;
+            return false;
+        }
+    }
+    std::set<std::pair<const Cursor*, std::string>> inserted;
+    for (const auto& write : m_writes) {
+        std::shared_lock<std::shared_mutex> reading(write.cursor->m_lock);
+        bool taken = write.cursor->m_mappedRows.contains(write.primaryKey) || write.cursor->m_pendingKeys.count(write.primaryKey) != 0;
+        if (write.operation == wal::INSERT && (taken || !inserted.emplace(write.cursor, write.primaryKey).second)) {
+            std::cerr << "Transaction aborted, key collision for primary key = " << write.primaryKey << std::endl;
+            return false;
+        }
+        if (write.operation == wal::UPDATE && !taken && inserted.count({ write.cursor, write.primaryKey }) == 0) {
+            std::cerr << "Transaction aborted, primary key not found " << write.primaryKey << std::endl;
+            return false;
+        }
+    }
+
+    uint64_t lsn = 0;
+    if (log != nullptr) {
+        std::vector<wal::Record> records;
+        for (const auto& write : m_writes) {
+            records.push_back(wal::Record{ 0, 0, write.operation, write.cursor->m_fileStream.getPath(), write.primaryKey, write.serialized });
+        }
+        lsn = log->appendTransaction(records);
+    }
+    for (const auto& write : m_writes) {
+        if (write.operation == wal::INSERT) {
+            write.cursor->m_pendingKeys.insert(write.primaryKey);
+        }
+    }
+    std::vector<uint64_t> tickets;
+    for (auto* cursor : writers) {
+        tickets.push_back(cursor->m_nextTicket++);
+    }
+
+    // one flush makes every write of the transaction durable
+    orders.clear();
+    bool durable = log == nullptr || log->waitDurable(lsn);
+    if (!durable) {
+        std::cerr << "Transaction not committed, the log could not be written" << std::endl;
+    }
+
+    // each table applies its part in its own turn, only one table is held at a time
+    for (size_t i = 0; i < writers.size(); i++) {
+        Cursor* cursor = writers[i];
+        size_t logged = 0;
+        for (const auto& write : m_writes) {
+            logged += write.cursor == cursor ? 1 : 0;
+        }
+        std::unique_lock<std::mutex> order(cursor->m_writeLock);
+        cursor->applyInTurn(order, tickets[i], log != nullptr ? logged : 0, [&]() {
+            for (auto& write : m_writes) {
+                if (write.cursor != cursor) {
+                    continue;
+                }
+                if (durable) {
+                    cursor->applyRow(write.primaryKey, std::move(write.serialized));
+                }
+                if (write.operation == wal::INSERT) {
+                    cursor->m_pendingKeys.erase(write.primaryKey);
+                }
+            }
+            });
+    }
+    m_writes.clear();
+    m_expectations.clear();
+    return durable;
+}
+
+void table::Transaction::rollback() noexcept
+{
+    m_writes.clear();
+    m_expectations.clear();
+    m_finished = true;
+}
+
+bool table::convertTable(const char* sourcePath, Serialization::Deserializer& sourceDeserializer, Serialization::FormatDescriptor& sourceFormat,
+    const char* destinationPath, Serialization::Serializer& destinationSerializer, Serialization::FormatDescriptor& destinationFormat)
+{
+    fileIO::MappedFile source(sourcePath);
+    if (!source.is_open()) {
+        std::cerr << "Error mapping file: " << sourcePath << std::endl;
+        return false;
+    }
+    std::ofstream destination(destinationPath, std::ios::binary | std::ios::trunc);
+    if (!destination.is_open()) {
+        std::cerr << "Error opening file for writing: " << destinationPath << std::endl;
+        return false;
+    }
+
+    std::string_view line;
+    std::streamoff offset;
+    std::string scratch;
+    std::vector<std::string_view> fields;
+    // a row replaced while a snapshot was open may still have its older copy in the file, the later copy is the current one
+    // as the cursor's open takes it, so only the last copy of each key is converted
+    KeyIndex current;
+    auto keys = sourceFormat.rowReader(source.view());
+    while (keys.next(line, offset)) {
+        if (!sourceDeserializer.isTombstone(line, &sourceFormat)) {
+            sourceDeserializer.tokenize(line, &sourceFormat, fields, scratch);
+            current.assign(fields.empty() ? std::string_view() : fields.front(), RowLocation{ offset, 0 });
+        }
+    }
+
+    Serialization::RowView row;
+    size_t converted = 0;
+    auto rows = sourceFormat.rowReader(source.view());
+    while (rows.next(line, offset)) {
+        if (sourceDeserializer.isTombstone(line, &sourceFormat)) {
+            continue;
+        }
+        sourceDeserializer.tokenize(line, &sourceFormat, fields, scratch);
+        if (current.find(fields.empty() ? std::string_view() : fields.front())->offset != offset) {
+            continue;
+        }
+        row.reset(fields);
+        destination << destinationSerializer.serialize(&row, &destinationFormat);
+        converted++;
+    }
+
+    destination.close();
+    if (destination.fail()) {
+        std::cerr << "Error writing file: " << destinationPath << std::endl;
+        return false;
+    }
+    std::cout << "\nConverted " << converted << " rows from " << sourcePath << " to " << destinationPath << "\n";
+    return true;
+}
@@ -3,20 +3,265 @@
 #include <string>
 #include <vector>
 #include <map>
+#include <unordered_map>
 #include <algorithm>
 #include <ranges>
 #include <fstream>
 #include <sstream>
 #include <functional>
 #include <optional>
+#include <string_view>
+#include <span>
+#include <cstdint>
+#include <new>
+#include <utility>
+#include <memory>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <future>
+#include <queue>
+#include <concepts>
+#include <shared_mutex>
+#include <unordered_set>
+#include <atomic>
+#include <array>
+#include "WriteAheadLog.h"
 namespace fileIO {
 
+	// read-only view of a whole file mapped into memory
+	class MappedFile {
+	private:
+		const char* m_data = nullptr;
+		size_t m_size = 0;
+		bool m_open = false;
+#ifdef _WIN32
+		void* m_file = nullptr;
+		void* m_mapping = nullptr;
+#endif
+		void release() noexcept;
+	public:
+		MappedFile() = default;
+		explicit MappedFile(const char* path);
+		~MappedFile() noexcept;
+		MappedFile(const MappedFile&) = delete;
+		MappedFile& operator=(const MappedFile&) = delete;
+		MappedFile(MappedFile&& other) noexcept;
+		MappedFile& operator=(MappedFile&& other) noexcept;
+
+		bool is_open() const noexcept {
+			return m_open;
+		}
+		std::string_view view() const noexcept {
+			return std::string_view(m_data, m_size);
+		}
+	};
+
+	// reads a LEB128 varint at position and moves past it, false when the bytes run out
+	inline bool readVarint(std::string_view data, size_t& position, uint64_t& value) noexcept {
+		value = 0;
+		for (unsigned shift = 0; position < data.size() && shift < 64; shift += 7) {
+			auto byte = static_cast<unsigned char>(data[position++]);
+			value |= static_cast<uint64_t>(byte & 0x7f) << shift;
+			if ((byte & 0x80) == 0) {
+				return true;
+			}
+		}
+		return false;
+	}
+
+	// width pads the encoding with continuation bytes so a value can be rewritten in place
+	inline void writeVarint(std::string& out, uint64_t value, size_t width = 0) {
+		size_t written = 0;
+		while (value >= 0x80 || written + 1 < width) {
+			out.push_back(static_cast<char>((value & 0x7f) | 0x80));
+			value >>= 7;
+			written++;
+		}
+		out.push_back(static_cast<char>(value));
+	}
+
+	inline size_t varintSize(uint64_t value) noexcept {
+		size_t size = 1;
+		while (value >= 0x80) {
+			value >>= 7;
+			size++;
+		}
+		return size;
+	}
+
+	// walks the rows of a contiguous byte range, rows come out without their framing
+	// text rows end with a separator, binary rows start with their length as a varint
+	class RowReader {
+	private:
+		std::string_view m_data;
+		size_t m_position = 0;
+		char m_separator = '\n';
+		bool m_lengthPrefixed = false;
+		bool m_complete = true;
+		std::string_view m_record;
+	public:
+		RowReader(std::string_view data, char separator) : m_data(data), m_separator(separator) {}
+		static RowReader lengthPrefixed(std::string_view data) noexcept {
+			RowReader reader(data, '\0');
+			reader.m_lengthPrefixed = true;
+			return reader;
+		}
+		bool next(std::string_view& row, std::streamoff& offset) noexcept {
+			if (m_position >= m_data.size()) {
+				return false;
+			}
+			offset = static_cast<std::streamoff>(m_position);
+			if (m_lengthPrefixed) {
+				size_t start = m_position;
+				uint64_t length = 0;
+				if (!readVarint(m_data, m_position, length) || length > m_data.size() - m_position) {
+					// a row torn by a crash, nothing after it can be framed
+					m_position = start;
+					m_complete = false;
+					return false;
+				}
+				row = m_data.substr(m_position, length);
+				m_position += length;
+				m_record = m_data.substr(start, m_position - start);
+				return true;
+			}
+			size_t end = m_data.find(m_separator, m_position);
+			if (end == std::string_view::npos) {
+				end = m_data.size();
+				m_complete = false;
+			}
+			row = m_data.substr(m_position, end - m_position);
+			m_record = m_data.substr(m_position, std::min(end + 1, m_data.size()) - m_position);
+			m_position = end + 1;
+			return true;
+		}
+		// the last row with its framing, the whole slot it occupies in the file
+		std::string_view record() const noexcept {
+			return m_record;
+		}
+		// where the framed rows end, anything past it is a torn row
+		size_t position() const noexcept {
+			return std::min(m_position, m_data.size());
+		}
+		// false once the walk ran into a row cut short at the end of the range
+		bool complete() const noexcept {
+			return m_complete;
+		}
+	};
+
+	// fixed-size pages of one file kept in memory under a byte budget
+	// a pinned page stays put, an unpinned one is evicted with CLOCK and written back first when it is dirty
+	class PagePool {
+	public:
+		static constexpr size_t pageSize = 4096;
+		// a small table never fills it, frames come as its pages are read
+		static constexpr size_t defaultBudget = 4 << 20;
+		// fills dest, pageSize bytes long, from the file and returns how many bytes the page has
+		using PageReader = std::function<size_t(uint64_t page, char* dest)>;
+		using PageWriter = std::function<bool(uint64_t page, const char* data, size_t length)>;
+
+		struct Counters {
+			uint64_t hits = 0;
+			uint64_t misses = 0;
+			uint64_t evictions = 0;
+			uint64_t writebacks = 0;
+			size_t resident = 0;
+			size_t dirty = 0;
+		};
+
+		// a page held in memory until the pin goes away, empty when no frame was free
+		class Pin {
+		private:
+			PagePool* m_pool = nullptr;
+			size_t m_frame = 0;
+			const char* m_data = nullptr;
+			size_t m_size = 0;
+			friend class PagePool;
+			Pin(PagePool* pool, size_t frame, const char* data, size_t size) : m_pool(pool), m_frame(frame), m_data(data), m_size(size) {}
+		public:
+			Pin() = default;
+			Pin(Pin&& other) noexcept;
+			Pin& operator=(Pin&& other) noexcept;
+			Pin(const Pin&) = delete;
+			Pin& operator=(const Pin&) = delete;
+			~Pin() noexcept;
+			explicit operator bool() const noexcept {
+				return m_pool != nullptr;
+			}
+			const char* data() const noexcept {
+				return m_data;
+			}
+			// the page's bytes, fewer than pageSize only for the last page of the file
+			size_t size() const noexcept {
+				return m_size;
+			}
+			void release() noexcept;
+		};
+	private:
+		struct Frame {
+			uint64_t page = 0;
+			std::unique_ptr<char[]> data;
+			size_t length = 0;
+			uint32_t pins = 0;
+			bool used = false;
+			bool dirty = false;
+			bool referenced = false;
+		};
+		PageReader m_read;
+		PageWriter m_write;
+		std::mutex m_lock;
+		// allocated as pages come in, never past the budget and never moved while pinned
+		std::vector<Frame> m_frames;
+		std::atomic<size_t> m_frameLimit = 0;
+		// bumped by every write, a page read while it moved is handed out but not kept
+		uint64_t m_epoch = 0;
+		std::unordered_map<uint64_t, size_t> m_places;
+		size_t m_hand = 0;
+		Counters m_counters;
+
+		// the caller holds m_lock
+		std::optional<size_t> freeFrame();
+		bool writeBack(Frame& frame);
+		void unpin(size_t frame) noexcept;
+	public:
+		PagePool(PageReader read, PageWriter write, size_t budgetBytes = defaultBudget);
+		PagePool(const PagePool&) = delete;
+		PagePool& operator=(const PagePool&) = delete;
+
+		// reads the page in on a miss
+		Pin pin(uint64_t page);
+		// copies a write into the resident pages it touches, marking them dirty
+		// false when part of it fell on a page that is not resident, or past a page's end, the caller writes it through then
+		bool write(uint64_t offset, const char* data, size_t length);
+		// writes every dirty page back
+		bool flush();
+		// drops every page without writing it back, for when the file underneath was replaced
+		void discard();
+		// flushes and drops every page and starts the counters over, 0 leaves all I/O to the file
+		bool resize(size_t budgetBytes);
+		size_t budget() noexcept;
+		Counters counters();
+	};
+
 	class FileStream{
 	private:
 		const char* m_completePath;
 		const char* tag;
 		std::fstream fileStream;
-		
+		// pages are read and written back through their own handle and never move the stream's position
+#ifdef _WIN32
+		void* m_pageHandle = nullptr;
+#else
+		int m_pageDescriptor = -1;
+#endif
+		mutable PagePool m_pages;
+		// bumped by every change to the file, the cursors sharing the stream tell by it whether another one wrote
+		std::atomic<uint64_t> m_writes = 0;
+		void open();
+		void closePageHandle() noexcept;
+		size_t readDirect(std::streamoff offset, size_t length, char* dest) const noexcept;
+		bool writeDirect(std::streamoff offset, const char* data, size_t length) const noexcept;
 	public:
 		FileStream(const char* path , const char * tag);
 		~FileStream()noexcept;
@@ -24,9 +269,11 @@ namespace fileIO {
 		
 		FileStream(const FileStream& other);
 		
-		bool deleteLine(size_t lineNumber , const char * delim);
-		bool overrideLine(size_t lineNumber, const char* newContent);
 		void reopen();
+		// atomically swaps the file for the one at replacementPath and reopens it
+		bool replaceWith(const std::string& replacementPath);
+		// cuts the file back to length bytes and reopens it
+		bool truncate(std::streamoff length);
 		bool is_open() {
 			return fileStream.is_open();
 		}
@@ -44,12 +291,29 @@ namespace fileIO {
 		const char * getNextLine(std::string& dest ,const char* delim)noexcept;
 		std::string getFileContent()  noexcept;
 
+		std::streamoff size() noexcept;
+		// positional read through the page pool, any number of threads may read at once as long as nobody writes
+		bool readAt(std::streamoff offset, size_t length, std::string& dest) const noexcept;
+		// lands in the resident pages when it can and reaches the file on flush, otherwise goes straight to the file
+		bool writeAt(std::streamoff offset, const char* data, size_t length) noexcept;
+		// appends go straight to the file, resident pages they touch are brought up to date
+		std::streamoff append(const char* data, size_t length) noexcept;
+		// writes the dirty pages back, the file holds every write made so far once it returns
+		bool flush() const noexcept;
+		// memory the page pool may use, 0 reads and writes the file directly
+		void setPageBudget(size_t budgetBytes);
+		PagePool::Counters pageCounters() const;
+		// maps the current file contents for scanning, later appends are not visible through it
+		MappedFile map() const noexcept;
+		uint64_t writeCount() const noexcept {
+			return m_writes.load();
+		}
+
 		
 	};
 
-	
-
-	
+	// flushes a file's contents to stable storage
+	bool syncFile(const char* path) noexcept;
 
 
 }
@@ -60,6 +324,10 @@ namespace Serialization {
 	
 		virtual std::vector<std::string> getContent() const noexcept = 0;
 		virtual std::string getPrimaryKey() const = 0;
+		// borrowed view of the fields, rows produced by the engine read them without copying
+		virtual std::span<const std::string_view> getFieldViews() const noexcept {
+			return {};
+		}
 		virtual ~Serializable() = default;
 		void cout() const {
 			std::cout << "Row = ";
@@ -73,18 +341,62 @@ namespace Serialization {
 	class RowEntry : public Serializable {
 	private:
 		std::vector<std::string> m_content;
+		std::vector<std::string_view> m_views;
 	public:
-		RowEntry(std::vector<std::string>& rows) : Serializable()  , m_content(rows){}
+		RowEntry(std::vector<std::string>& rows) : Serializable()  , m_content(rows), m_views(m_content.begin(), m_content.end()){}
+		// the views have to point at this entry's own strings
+		RowEntry(const RowEntry& other) : Serializable(), m_content(other.m_content), m_views(m_content.begin(), m_content.end()) {}
+		RowEntry& operator=(const RowEntry& other) {
+			if (this != &other) {
+				m_content = other.m_content;
+				m_views.assign(m_content.begin(), m_content.end());
+			}
+			return *this;
+		}
 		std::vector<std::string> getContent() const noexcept override {
 			return m_content;
 		}
+		std::span<const std::string_view> getFieldViews() const noexcept override {
+			return m_views;
+		}
 		
 		std::string getPrimaryKey() const override {
-			return getContent().at(0);
+			return m_content.at(0);
+		}
+	};
+
+	// row over fields it does not own, the storage belongs to a scan buffer or a result arena
+	class RowView : public Serializable {
+	private:
+		std::span<const std::string_view> m_fields;
+	public:
+		RowView(std::span<const std::string_view> fields = {}) : Serializable(), m_fields(fields) {}
+		void reset(std::span<const std::string_view> fields) noexcept {
+			m_fields = fields;
+		}
+		std::vector<std::string> getContent() const noexcept override {
+			return std::vector<std::string>(m_fields.begin(), m_fields.end());
+		}
+		std::span<const std::string_view> getFieldViews() const noexcept override {
+			return m_fields;
+		}
+		// a row without fields, an empty line or a binary row of none, has an empty key
+		std::string getPrimaryKey() const override {
+			return m_fields.empty() ? std::string() : std::string(m_fields.front());
 		}
 	};
 
 
+	enum ColumnType {
+		TEXT,
+		// values that are canonical 64 bit integers, anything else in the column is kept as text
+		INTEGER,
+		// year-month-day, the parts may or may not be zero padded
+		DATE,
+		// fixed point with up to 6 decimals
+		DECIMAL
+	};
+
 	struct FormatDescriptor {
 		virtual const char* getColumnSeparator() const noexcept {
 			return ",";
@@ -98,15 +410,58 @@ namespace Serialization {
 		virtual const char* getRowSeparatorSubstitute() const noexcept {
 			return "<|>";
 		}
+		// rows starting with this marker are dead space left behind by updates
+		virtual const char* getTombstoneMarker() const noexcept {
+			return "#";
+		}
+		// written for the marker when a live row's first field starts with it
+		virtual const char* getTombstoneMarkerSubstitute() const noexcept {
+			return "<#>";
+		}
+		virtual ColumnType getColumnType([[maybe_unused]] size_t column) const noexcept {
+			return TEXT;
+		}
+		// rows are framed by their length in front instead of a separator after them
+		virtual bool isLengthPrefixed() const noexcept {
+			return false;
+		}
+		fileIO::RowReader rowReader(std::string_view data) const noexcept {
+			if (isLengthPrefixed()) {
+				return fileIO::RowReader::lengthPrefixed(data);
+			}
+			return fileIO::RowReader(data, *getRowSeparator());
+		}
 	
 	};
 
+	// compact binary rows, nothing is escaped and integer columns are stored as varints
+	// row: varint length, varint field count + 1 (0 marks a dead row), the fields, padding
+	// field: varint (length << 1) followed by the text, or varint (zigzag(value) << 1 | 1) for an integer
+	struct BinaryFormatDescriptor : FormatDescriptor {
+		std::vector<ColumnType> columnTypes;
+		BinaryFormatDescriptor(std::vector<ColumnType> columnTypes = std::vector<ColumnType>()) : columnTypes(std::move(columnTypes)) {}
+		ColumnType getColumnType(size_t column) const noexcept override {
+			return column < columnTypes.size() ? columnTypes[column] : TEXT;
+		}
+		bool isLengthPrefixed() const noexcept override {
+			return true;
+		}
+	};
+
 	struct Serializer {
 	private:
 		
 	public:
-		virtual  std::string serialize(const Serializable* obj, FormatDescriptor* fd);
-		void sanitizeField( std::string& field ,FormatDescriptor* fd);
+		std::string serialize(const Serializable* obj, FormatDescriptor* fd);
+		// appends the record to out, a caller writing many rows reuses one buffer for all of them
+		virtual void serializeInto(std::string& out, const Serializable* obj, FormatDescriptor* fd);
+		// leading is set for the row's first field, which must not start with the tombstone marker
+		void sanitizeField( std::string& field ,FormatDescriptor* fd, bool leading = false);
+		// builds a dead record spanning exactly length bytes
+		virtual std::string tombstone(size_t length, FormatDescriptor* fd);
+		// pads a serialized record to fill a slot of the given length, false if it doesn't fit
+		virtual bool fitInto(std::string& record, size_t length, FormatDescriptor* fd);
+		virtual ~Serializer() = default;
 	};
     
 	struct Deserializer {
@@ -115,7 +470,32 @@ namespace Serialization {
 
 	public:
 		void removeSanitation( std::string& field , FormatDescriptor* fd);
-		virtual std::vector<std::string> deserialize(const char* line, FormatDescriptor* fd);
+		virtual std::vector<std::string> deserialize(std::string_view line, FormatDescriptor* fd);
+		// splits a row without copying, fields point into line or, when they carried substitutes, into scratch
+		virtual void tokenize(std::string_view line, FormatDescriptor* fd, std::vector<std::string_view>& fields, std::string& scratch);
+		// tokenize for the columns where wanted is set, the rest come back empty and the row is split no further than wanted reaches
+		virtual void tokenizeColumns(std::string_view line, FormatDescriptor* fd, std::span<const uint8_t> wanted, std::vector<std::string_view>& fields, std::string& scratch);
+		virtual bool isTombstone(std::string_view line, FormatDescriptor* fd);
+		// matches "column == value" on a stored row before it is split, empty when the format can't tell without splitting
+		virtual std::function<bool(std::string_view)> equalityFilter(size_t column, std::string_view value, FormatDescriptor* fd);
+		virtual ~Deserializer() = default;
+	};
+
+	struct BinarySerializer : Serializer {
+		void serializeInto(std::string& out, const Serializable* obj, FormatDescriptor* fd) override;
+		std::string tombstone(size_t length, FormatDescriptor* fd) override;
+		bool fitInto(std::string& record, size_t length, FormatDescriptor* fd) override;
+		// appends one field the way a column of the given type stores it
+		static void encodeField(std::string& out, std::string_view field, ColumnType type);
+	};
+
+	struct BinaryDeserializer : Deserializer {
+		// integer fields are formatted into scratch, text fields stay views into the row
+		void tokenize(std::string_view line, FormatDescriptor* fd, std::vector<std::string_view>& fields, std::string& scratch) override;
+		void tokenizeColumns(std::string_view line, FormatDescriptor* fd, std::span<const uint8_t> wanted, std::vector<std::string_view>& fields, std::string& scratch) override;
+		bool isTombstone(std::string_view line, FormatDescriptor* fd) override;
+		// compares the encoded field bytes, integers are never parsed
+		std::function<bool(std::string_view)> equalityFilter(size_t column, std::string_view value, FormatDescriptor* fd) override;
 	};
 
 }
@@ -130,34 +510,317 @@ namespace util {
 		return str;
 	}
 
+	// bump allocator handing out memory from large blocks, everything is freed together
+	class Arena {
+	private:
+		std::vector<std::unique_ptr<char[]>> m_blocks;
+		char* m_cursor = nullptr;
+		size_t m_remaining = 0;
+		size_t m_blockSize = 64 * 1024;
+		size_t m_reserved = 0;
+	public:
+		explicit Arena(size_t blockSize = 64 * 1024) : m_blockSize(blockSize) {}
+		Arena(const Arena&) = delete;
+		Arena& operator=(const Arena&) = delete;
+		Arena(Arena&& other) noexcept {
+			*this = std::move(other);
+		}
+		Arena& operator=(Arena&& other) noexcept {
+			if (this != &other) {
+				m_blocks = std::move(other.m_blocks);
+				m_cursor = std::exchange(other.m_cursor, nullptr);
+				m_remaining = std::exchange(other.m_remaining, 0);
+				m_blockSize = other.m_blockSize;
+				m_reserved = std::exchange(other.m_reserved, 0);
+				other.m_blocks.clear();
+			}
+			return *this;
+		}
+
+		void* allocate(size_t size, size_t alignment = alignof(std::max_align_t));
+		std::string_view copy(std::string_view text);
+		// objects made here never have their destructors run
+		template<typename T, typename... Args>
+		T* make(Args&&... args) {
+			return new (allocate(sizeof(T), alignof(T))) T(std::forward<Args>(args)...);
+		}
+		// takes over the blocks of another arena
+		void absorb(Arena&& other);
+		void release() noexcept;
+		size_t bytesReserved() const noexcept {
+			return m_reserved;
+		}
+	};
+
+	// fixed set of worker threads pulling tasks from one queue
+	class ThreadPool {
+	private:
+		std::vector<std::thread> m_workers;
+		std::queue<std::function<void()>> m_tasks;
+		std::mutex m_lock;
+		std::condition_variable m_wakeUp;
+		bool m_stopping = false;
+	public:
+		explicit ThreadPool(size_t threadCount);
+		~ThreadPool() noexcept;
+		ThreadPool(const ThreadPool&) = delete;
+		ThreadPool& operator=(const ThreadPool&) = delete;
+		size_t size() const noexcept {
+			return m_workers.size();
+		}
+		std::future<void> submit(std::function<void()> task);
+		// process wide pool with one worker per core
+		static ThreadPool& shared();
+	};
+
+}
+namespace table {
+	class Table;
 }
 namespace query {
 	enum Type {
 		SELECT,
 		UPDATE,
 		DELETE,
-		INSERT
+		INSERT,
+		JOIN,
+		AGGREGATE
 	};
 
 	struct Target {
 		std::vector<std::string> labels;
 		Target(const std::vector<std::string>& labels = std::vector<std::string>()):labels(labels) {}
 	};
+
+	// a value compared against a column, it is read as the column's type once the query meets a table
+	struct Literal {
+		std::string text;
+		Literal(std::string text) : text(std::move(text)) {}
+		Literal(const char* text) : text(text) {}
+		template<std::integral T>
+		Literal(T value) : text(std::to_string(value)) {}
+	};
+
+	// comparisons on named columns combined with and/or, built with eq, lt, le, gt, ge, range, && and ||
+	struct Expression {
+		enum Kind {
+			EQ,
+			LT,
+			LE,
+			GT,
+			GE,
+			// inclusive on both ends
+			RANGE,
+			AND,
+			OR
+		};
+		Kind kind = AND;
+		std::string column;
+		std::string value;
+		std::string upper;
+		std::vector<Expression> children;
+	};
+
+	inline Expression eq(const std::string& column, const Literal& value) {
+		return Expression{ Expression::EQ, column, value.text, {}, {} };
+	}
+	inline Expression lt(const std::string& column, const Literal& value) {
+		return Expression{ Expression::LT, column, value.text, {}, {} };
+	}
+	inline Expression le(const std::string& column, const Literal& value) {
+		return Expression{ Expression::LE, column, value.text, {}, {} };
+	}
+	inline Expression gt(const std::string& column, const Literal& value) {
+		return Expression{ Expression::GT, column, value.text, {}, {} };
+	}
+	inline Expression ge(const std::string& column, const Literal& value) {
+		return Expression{ Expression::GE, column, value.text, {}, {} };
+	}
+	inline Expression range(const std::string& column, const Literal& from, const Literal& to) {
+		return Expression{ Expression::RANGE, column, from.text, to.text, {} };
+	}
+	inline Expression operator&&(Expression left, Expression right) {
+		// chains of the same operator stay one flat node
+		if (left.kind == Expression::AND && !left.children.empty()) {
+			left.children.push_back(std::move(right));
+			return left;
+		}
+		return Expression{ Expression::AND, "", "", "", { std::move(left), std::move(right) } };
+	}
+	inline Expression operator||(Expression left, Expression right) {
+		if (left.kind == Expression::OR && !left.children.empty()) {
+			left.children.push_back(std::move(right));
+			return left;
+		}
+		return Expression{ Expression::OR, "", "", "", { std::move(left), std::move(right) } };
+	}
+
+	// a block of rows split into column vectors, evaluateBatch tests a whole block per pass
+	// fields point into the scanned data, or into the block's own storage when they had to be unescaped
+	struct Batch {
+		static constexpr size_t capacity = 1024;
+		size_t size = 0;
+		// the stored rows, kept so only the selected ones are split again
+		std::vector<std::string_view> rows;
+		// the table columns gathered, and for each table column its slot or npos
+		std::vector<size_t> gathered;
+		std::vector<size_t> slots;
+		// field of row i in slot s is at columns[s * capacity + i], present says the row had that field at all
+		std::vector<std::string_view> columns;
+		std::vector<uint8_t> present;
+		util::Arena storage;
+		// filled by evaluateBatch, one key vector per typed slot and one mask per expression node
+		std::vector<int64_t> keys;
+		std::vector<uint8_t> parsed;
+		std::vector<uint8_t> keyed;
+		std::vector<std::vector<uint8_t>> masks;
+
+		// empties the block and sets which columns it gathers
+		void reset(const std::vector<size_t>& columns);
+		void clear() noexcept;
+		// data is the scanned buffer, fields outside of it are copied into storage
+		void append(std::string_view row, std::span<const std::string_view> fields, std::string_view data);
+	};
+
+	// an expression bound to column positions with its literals parsed once, evaluated on the field bytes
+	// comparisons on typed columns become inclusive ranges over an integer key, text compares bytes
+	class CompiledExpression {
+	public:
+		struct Node {
+			Expression::Kind kind = Expression::AND;
+			size_t column = 0;
+			Serialization::ColumnType type = Serialization::TEXT;
+			int64_t low = 0;
+			int64_t high = 0;
+			// the literals as written, text comparisons and index lookups use them
+			std::string lowText;
+			std::string highText;
+			std::vector<size_t> children;
+		};
+	private:
+		std::vector<Node> m_nodes;
+		size_t add(const Expression& expression, const std::vector<std::string>& columnNames, const std::vector<Serialization::ColumnType>& columnTypes, bool& valid);
+		bool evaluate(size_t node, std::span<const std::string_view> fields) const;
+		void evaluateBatch(size_t node, Batch& batch, uint8_t* selection, const uint8_t* active, uint8_t activeValue) const;
+	public:
+		// nullopt, after saying why, when a column is unknown or a literal doesn't read as its column's type
+		static std::optional<CompiledExpression> compile(const Expression& expression, const std::vector<std::string>& columnNames, const std::vector<Serialization::ColumnType>& columnTypes);
+		// the integer a typed column orders a field by, false when the field doesn't parse
+		static bool parseKey(std::string_view field, Serialization::ColumnType type, int64_t& key) noexcept;
+		bool evaluate(std::span<const std::string_view> fields) const {
+			return evaluate(0, fields);
+		}
+		// selection[i] is 1 for the rows of the block the expression accepts
+		void evaluateBatch(Batch& batch, std::vector<uint8_t>& selection) const;
+		const Node& root() const noexcept {
+			return m_nodes.front();
+		}
+		const Node& node(size_t index) const noexcept {
+			return m_nodes[index];
+		}
+		std::vector<size_t> columns() const;
+	};
+
 	struct Predicate {
 		std::function<bool(const Serialization::Serializable*)> predicate;
-		Predicate(std::function<bool(const Serialization::Serializable*)> predicate = [](const Serialization::Serializable* obj)-> bool { return obj != nullptr; }):predicate(predicate){}
+		// set when the predicate is exactly "primary key == value", lets the table skip the scan
+		std::optional<std::string> primaryKey;
+		// names of the columns the predicate looks at, unset when it may look at any of them
+		std::optional<std::vector<std::string>> reads;
+		Predicate() :predicate([](const Serialization::Serializable* obj)-> bool { return obj != nullptr; }), reads(std::vector<std::string>()) {}
+		Predicate(std::function<bool(const Serialization::Serializable*)> predicate):predicate(predicate){}
+
+		// set when the predicate is exactly "column == value", the table binds it to the column position
+		struct Equality {
+			std::string column;
+			std::string value;
+		};
+		std::optional<Equality> equality;
+		// set by the table along with the equality, scans test it on the stored row before splitting it
+		std::function<bool(std::string_view)> rowFilter;
+
+		// set by where(), the table compiles it against its schema
+		std::optional<Expression> expression;
+		std::shared_ptr<const CompiledExpression> compiled;
+
+		static Predicate where(Expression expression) {
+			// matches nothing until a table compiles the expression
+			Predicate result([](const Serialization::Serializable*) -> bool { return false; });
+			result.expression = std::move(expression);
+			return result;
+		}
+
+		static Predicate columnEquals(const std::string& column, const std::string& value) {
+			// matches nothing until a table resolves the column
+			Predicate result([](const Serialization::Serializable*) -> bool { return false; });
+			result.equality = Equality{ column, value };
+			result.reads = std::vector<std::string>{ column };
+			return result;
+		}
+
+		static Predicate primaryKeyEquals(const std::string& key) {
+			Predicate result([key](const Serialization::Serializable* obj) -> bool {
+				return obj != nullptr && obj->getPrimaryKey() == key;
+				});
+			result.primaryKey = key;
+			return result;
+		}
 	};
 	struct PayLoad {
 		std::vector<Serialization::Serializable*> payLoad;
 		PayLoad(const std::vector<Serialization::Serializable*>& objs = std::vector<Serialization::Serializable*>()):payLoad(objs){}
 	};
+	// how a SELECT walks the table file
+	// with threads > 1 the predicate is called concurrently from several threads: it must not touch
+	// shared mutable state without its own synchronization, and the row it gets is only valid during the call
+	struct ScanOptions {
+		size_t threads = 1; // 0 uses every core
+		bool preserveOrder = true; // false hands back rows in the order chunks finish
+	};
+	// rows of the queried table are paired with the rows of inner whose innerColumn equals their column
+	// a joined row holds the target columns of the queried table followed by innerLabels, empty meaning every column
+	struct Join {
+		table::Table* inner = nullptr;
+		std::string column;
+		std::string innerColumn;
+		std::vector<std::string> innerLabels;
+	};
+	// values that do not parse as the column's type are skipped, like NULL in SQL
+	// SUM and AVG read TEXT columns as floating point, MIN and MAX compare TEXT columns as bytes
+	struct Aggregate {
+		enum Function {
+			COUNT,
+			SUM,
+			MIN,
+			MAX,
+			AVG
+		};
+		// SUM and AVG refuse a DATE column
+		Function function;
+		// empty counts every row, only COUNT allows it
+		std::string column;
+	};
+	// TEXT columns sort as bytes, typed ones by value, values that do not parse as the type come last either way
+	struct Order {
+		std::string column;
+		bool descending = false;
+	};
 	struct Query {
 		Type type;
 		Target target;
 		Predicate predicate;
 		PayLoad payLoad;
-		Query():type(SELECT),target(),predicate(),payLoad(){}
-		Query(Type type, Target&& target, Predicate&& predicate , PayLoad&& payLoad) :type(type), target(target), predicate(predicate) , payLoad(payLoad) {};
+		ScanOptions scan;
+		std::optional<Join> join;
+		// a SELECT with either keeps no more than offset + limit rows while it reads
+		std::optional<Order> orderBy;
+		std::optional<size_t> limit;
+		size_t offset = 0;
+		// a result row holds the groupBy columns followed by one value per aggregate, groups come in the order of their first row
+		std::vector<std::string> groupBy;
+		std::vector<Aggregate> aggregates;
+		Query():type(SELECT),target(),predicate(),payLoad(),scan(){}
+		Query(Type type, Target&& target, Predicate&& predicate , PayLoad&& payLoad) :type(type), target(target), predicate(predicate) , payLoad(payLoad), scan() {};
 		void printQuery() {
 			switch (type)
 			{
@@ -176,6 +839,14 @@ namespace query {
 				std::cout << "INSERT ";
 			}
 				break;
+			case query::JOIN: {
+				std::cout << "JOIN ";
+			}
+				break;
+			case query::AGGREGATE: {
+				std::cout << "AGGREGATE ";
+			}
+				break;
 			default: {
 				std::cout << "UNDEFINED ";
 			}
@@ -213,7 +884,54 @@ namespace query {
 		}
 
 		QueryBuilder& setPredicate(const std::function<bool(const Serialization::Serializable*)>& predicate) {
-			query_->predicate.predicate = predicate;
+			query_->predicate = Predicate(predicate);
+			return *this;
+		}
+
+		QueryBuilder& whereEquals(const std::string& column, const std::string& value) {
+			query_->predicate = Predicate::columnEquals(column, value);
+			return *this;
+		}
+
+		QueryBuilder& where(Expression expression) {
+			query_->predicate = Predicate::where(std::move(expression));
+			return *this;
+		}
+
+		QueryBuilder& wherePrimaryKey(const std::string& key) {
+			query_->predicate = Predicate::primaryKeyEquals(key);
+			return *this;
+		}
+
+		QueryBuilder& setParallelism(size_t threads, bool preserveOrder = true) {
+			query_->scan = ScanOptions{ threads, preserveOrder };
+			return *this;
+		}
+
+		// the predicate set on the builder still filters the queried table before it is joined
+		QueryBuilder& join(table::Table& inner, const std::string& column, const std::string& innerColumn, const std::vector<std::string>& innerLabels = std::vector<std::string>()) {
+			query_->join = Join{ &inner, column, innerColumn, innerLabels };
+			return *this;
+		}
+
+		QueryBuilder& orderBy(const std::string& column, bool descending = false) {
+			query_->orderBy = Order{ column, descending };
+			return *this;
+		}
+
+		QueryBuilder& limit(size_t count, size_t offset = 0) {
+			query_->limit = count;
+			query_->offset = offset;
+			return *this;
+		}
+
+		QueryBuilder& groupBy(const std::vector<std::string>& columns) {
+			query_->groupBy = columns;
+			return *this;
+		}
+
+		QueryBuilder& aggregate(Aggregate::Function function, const std::string& column = std::string()) {
+			query_->aggregates.push_back(Aggregate{ function, column });
 			return *this;
 		}
 
@@ -234,15 +952,364 @@ namespace query {
 }
 namespace table {
 
+	// where a row lives inside the table file, length includes the row separator
+	struct RowLocation {
+		std::streamoff offset;
+		size_t length;
+	};
+
+	// primary key to row location, open addressing with linear probing over one flat array of 24 byte slots
+	// every key lives length prefixed in a single buffer and a slot keeps 32 bits of its hash, so a probe reads the key only on a hash match
+	// keys are never removed one by one, a delete builds a new index
+	class KeyIndex {
+	private:
+		struct Slot {
+			uint64_t rowOffset = 0;
+			uint64_t keyOffset = 0;
+			// 0 marks an empty slot, no key hashes to it
+			uint32_t hash = 0;
+			uint32_t rowLength = 0;
+		};
+		std::vector<Slot> m_slots;
+		std::string m_keys;
+		size_t m_size = 0;
+
+		static uint32_t hashOf(std::string_view key) noexcept;
+		std::string_view keyAt(const Slot& slot) const noexcept;
+		// the slot holding key, or the empty slot where it would go
+		size_t probe(std::string_view key, uint32_t hash) const noexcept;
+		void grow();
+	public:
+		size_t size() const noexcept {
+			return m_size;
+		}
+		bool contains(std::string_view key) const noexcept {
+			return find(key).has_value();
+		}
+		std::optional<RowLocation> find(std::string_view key) const noexcept;
+		// false, leaving the index as it was, when the key is taken
+		bool insert(std::string_view key, RowLocation location);
+		// inserts the key or moves it to a new location
+		void assign(std::string_view key, RowLocation location);
+		void reserve(size_t count);
+		void clear() noexcept;
+		void swap(KeyIndex& other) noexcept;
+		// keys come in no particular order
+		template<typename Visit>
+		void forEach(Visit&& visit) const {
+			for (const auto& slot : m_slots) {
+				if (slot.hash != 0) {
+					visit(keyAt(slot), RowLocation{ static_cast<std::streamoff>(slot.rowOffset), slot.rowLength });
+				}
+			}
+		}
+		// heap memory the slots and the keys hold
+		size_t bytesReserved() const noexcept {
+			return m_slots.capacity() * sizeof(Slot) + m_keys.capacity();
+		}
+		// the slots and keys as they sit in memory, checksum covers both
+		void save(std::ostream& out) const;
+		uint64_t checksum() const noexcept;
+		size_t capacity() const noexcept {
+			return m_slots.size();
+		}
+		size_t keyBytes() const noexcept {
+			return m_keys.size();
+		}
+		// takes back what save wrote, false when the sizes don't add up
+		bool load(std::string_view data, size_t count, size_t capacity, size_t keyBytes);
+	};
+
+	enum IndexKind {
+		HASH,
+		ORDERED
+	};
+
+	// maps the values of one column to the primary keys of the rows holding them
+	class SecondaryIndex {
+	private:
+		size_t m_column;
+		IndexKind m_kind;
+		std::unordered_multimap<std::string, std::string> m_hashed;
+		std::multimap<std::string, std::string> m_ordered;
+	public:
+		SecondaryIndex(size_t column, IndexKind kind) : m_column(column), m_kind(kind) {}
+		size_t getColumn() const noexcept {
+			return m_column;
+		}
+		IndexKind getKind() const noexcept {
+			return m_kind;
+		}
+		void add(const std::string& value, const std::string& primaryKey);
+		void remove(const std::string& value, const std::string& primaryKey);
+		std::vector<std::string> lookup(const std::string& value) const;
+		// primary keys for values in [from, to], only for ORDERED indexes
+		std::vector<std::string> range(const std::string& from, const std::string& to) const;
+		// every entry sorted by value, empty unless the index is ORDERED
+		const std::multimap<std::string, std::string>& ordered() const noexcept {
+			return m_ordered;
+		}
+	};
+
+	// rows handed back by a query, the set owns every row and field in one arena
+	class ResultSet {
+	private:
+		util::Arena m_arena;
+		std::vector<const Serialization::RowView*> m_rows;
+	public:
+		ResultSet() = default;
+		ResultSet(const ResultSet&) = delete;
+		ResultSet& operator=(const ResultSet&) = delete;
+		ResultSet(ResultSet&&) noexcept = default;
+		ResultSet& operator=(ResultSet&&) noexcept = default;
+
+		// copies the fields at columnsIndexes, or all of them when empty, into the arena
+		void add(std::span<const std::string_view> fields, const std::vector<size_t>& columnsIndexes);
+		void absorb(ResultSet&& other);
+
+		size_t size() const noexcept {
+			return m_rows.size();
+		}
+		bool empty() const noexcept {
+			return m_rows.empty();
+		}
+		const Serialization::RowView* operator[](size_t index) const noexcept {
+			return m_rows[index];
+		}
+		auto begin() const noexcept {
+			return m_rows.begin();
+		}
+		auto end() const noexcept {
+			return m_rows.end();
+		}
+		size_t bytesReserved() const noexcept {
+			return m_arena.bytesReserved();
+		}
+	};
+
+	// the table file as it was when a read started, writes made after that never show through it
+	// while a snapshot is open, replaced rows keep their old slot, the snapshot skips the slots that were already replaced when it was taken
+	class Snapshot {
+	private:
+		fileIO::MappedFile m_mapped;
+		std::vector<std::streamoff> m_superseded;
+		std::shared_ptr<const int> m_token;
+	public:
+		Snapshot() = default;
+		Snapshot(fileIO::MappedFile&& mapped, std::vector<std::streamoff> superseded, std::shared_ptr<const int> token)
+			: m_mapped(std::move(mapped)), m_superseded(std::move(superseded)), m_token(std::move(token)) {}
+
+		std::string_view view() const noexcept {
+			return m_mapped.view();
+		}
+		// record is a whole row slot inside view(), as RowReader::record hands it out
+		bool isLive(std::string_view record) const noexcept {
+			return m_superseded.empty() || !std::binary_search(m_superseded.begin(), m_superseded.end(), static_cast<std::streamoff>(record.data() - m_mapped.view().data()));
+		}
+	};
+
+	// single pass range over the rows of a table snapshot that match a predicate
+	// the row an iterator points to is only valid until the iterator is advanced
+	class RowStream {
+	private:
+		Snapshot m_snapshot;
+		fileIO::RowReader m_rows;
+		Serialization::Deserializer* m_deserializer;
+		Serialization::FormatDescriptor* m_fd;
+		std::function<bool(const Serialization::Serializable*)> m_predicate;
+		std::function<bool(std::string_view)> m_rowFilter;
+		std::vector<size_t> m_columns;
+		std::string m_scratch;
+		std::vector<std::string_view> m_fields;
+		std::vector<std::string_view> m_projectedFields;
+		Serialization::RowView m_row;
+		const Serialization::RowView* m_current = nullptr;
+		void advance();
+	public:
+		RowStream(Snapshot&& snapshot, Serialization::Deserializer& deserializer, Serialization::FormatDescriptor& fd, std::function<bool(const Serialization::Serializable*)> predicate, std::vector<size_t> columnsIndexes, std::function<bool(std::string_view)> rowFilter = {});
+		RowStream(RowStream&& other) noexcept;
+		RowStream(const RowStream&) = delete;
+		RowStream& operator=(const RowStream&) = delete;
+
+		class iterator {
+		private:
+			RowStream* m_stream = nullptr;
+		public:
+			using iterator_concept = std::input_iterator_tag;
+			using value_type = Serialization::RowView;
+			using difference_type = std::ptrdiff_t;
+			using reference = const Serialization::RowView&;
+
+			iterator() = default;
+			explicit iterator(RowStream* stream) : m_stream(stream) {}
+			reference operator*() const {
+				return *m_stream->m_current;
+			}
+			const Serialization::RowView* operator->() const {
+				return m_stream->m_current;
+			}
+			iterator& operator++() {
+				m_stream->advance();
+				return *this;
+			}
+			void operator++(int) {
+				m_stream->advance();
+			}
+			bool operator==(std::default_sentinel_t) const {
+				return m_stream == nullptr || m_stream->m_current == nullptr;
+			}
+		};
+
+		// starts the walk, a stream can only be walked once
+		iterator begin();
+		std::default_sentinel_t end() const noexcept {
+			return std::default_sentinel;
+		}
+	};
+
+	// stored rows of recently read primary keys, bounded by bytes and split into shards that each take their own lock
+	// a shard evicts with CLOCK, a hit marks its entry and the hand passes over marked entries once, clearing the mark
+	class RowCache {
+	public:
+		struct Counters {
+			uint64_t hits = 0;
+			uint64_t misses = 0;
+			uint64_t evictions = 0;
+			size_t entries = 0;
+			size_t bytes = 0;
+		};
+	private:
+		struct Entry {
+			// the key of the entry's place in the shard's map, empty when the entry is free
+			const std::string* key = nullptr;
+			std::string row;
+			bool referenced = false;
+		};
+		struct KeyHash {
+			using is_transparent = void;
+			size_t operator()(std::string_view key) const noexcept {
+				return std::hash<std::string_view>()(key);
+			}
+		};
+		struct Shard {
+			mutable std::mutex lock;
+			std::unordered_map<std::string, size_t, KeyHash, std::equal_to<>> places;
+			std::vector<Entry> entries;
+			std::vector<size_t> freeEntries;
+			size_t hand = 0;
+			size_t bytes = 0;
+			Counters counters;
+		};
+		static constexpr size_t shardCount = 16;
+		std::array<Shard, shardCount> m_shards;
+		// 0 caches nothing
+		std::atomic<size_t> m_capacity = 0;
+
+		Shard& shardOf(std::string_view key) noexcept;
+		static size_t entryBytes(std::string_view key, std::string_view row) noexcept;
+		// the caller holds the shard's lock
+		void remove(Shard& shard, size_t place);
+	public:
+		explicit RowCache(size_t capacityBytes = 0) : m_capacity(capacityBytes) {}
+		RowCache(const RowCache&) = delete;
+		RowCache& operator=(const RowCache&) = delete;
+		size_t capacity() const noexcept {
+			return m_capacity.load();
+		}
+		// shrinking drops every entry
+		void resize(size_t capacityBytes);
+		bool get(std::string_view key, std::string& dest);
+		void put(std::string_view key, std::string_view row);
+		void erase(std::string_view key);
+		void clear();
+		Counters counters() const;
+	};
+
+	class Transaction;
+	class ColumnStore;
+
+	struct BulkLoadOptions {
+		// rows are serialized into one buffer of about this size and each full buffer is written with a single call
+		size_t bufferBytes = 4 << 20;
+		// false skips the message for every row whose key is taken, the rows are skipped all the same
+		bool reportCollisions = true;
+		// false leaves durability to the OS page cache
+		bool sync = true;
+	};
+
+	// what a bulk load did, reporting it is up to the caller
+	struct BulkLoadResult {
+		size_t loaded = 0;
+		// rows whose key was taken
+		size_t skipped = 0;
+		// a write or the final sync failed and the load stopped, the rows loaded before it stay
+		bool failed = false;
+	};
+
 	class Cursor {
 	private:
+		friend class Transaction;
 		fileIO::FileStream& m_fileStream;
 		Serialization::Deserializer& m_deserializer;
 		Serialization::Serializer& m_serializer;
 		Serialization::FormatDescriptor& fd;
-		std::map<std::string , int> m_mappedRows;
+		KeyIndex m_mappedRows;
+		std::vector<SecondaryIndex> m_indexes;
+		wal::WriteAheadLog* m_log = nullptr;
+		std::atomic<uint64_t> m_version = 0;
+
+		// readers share m_lock, a writer holds it alone only while it changes the file and the maps
+		mutable std::shared_mutex m_lock;
+		// writers check keys and append to the log in turn under m_writeLock, then wait for the log outside of it
+		// and apply their changes in the order they logged them
+		std::mutex m_writeLock;
+		std::condition_variable m_turn;
+		uint64_t m_nextTicket = 0;
+		uint64_t m_appliedTickets = 0;
+		// keys logged for insertion but not applied yet
+		std::unordered_set<std::string> m_pendingKeys;
+		// one reference per open snapshot, the slots of rows replaced while any is open are only tombstoned once all are gone
+		std::shared_ptr<int> m_snapshots = std::make_shared<int>(0);
+		std::vector<RowLocation> m_superseded;
+		// the file's write count as this cursor left it, a copy that fell behind another copy's writes never saves its key map
+		uint64_t m_writesSeen = 0;
+		// the write count the key index file was saved or loaded at, shared by the copies so only one of them saves it
+		std::shared_ptr<std::atomic<uint64_t>> m_keyIndexWrites = std::make_shared<std::atomic<uint64_t>>(UINT64_MAX);
+		// rows read by key, filled under the shared m_lock and emptied of a key whenever a write holds m_lock alone
+		mutable RowCache m_rowCache;
+		// shared by the copies of the cursor, every write lands in it as it lands in the row file
+		std::shared_ptr<ColumnStore> m_columnStore;
+
+		std::string keyIndexPath() const;
+		// fills the key map from the key index file, false when there is none or the table changed since it was written
+		bool loadKeyIndex();
+		// the caller holds m_lock exclusively
+		// writes a serialized row over the one with the same key, or appends it
+		void applyRow(const std::string& primaryKey, std::string serialized);
+		void retireSuperseded();
+		// the caller holds m_writeLock through order, waits for its ticket and applies under m_lock
+		// logged is how many of the log's records it applies
+		void applyInTurn(std::unique_lock<std::mutex>& order, uint64_t ticket, size_t logged, const std::function<void()>& apply);
+		// the caller holds m_writeLock with nothing left to apply
+		bool checkpointLocked();
+		// deleteRows without taking its turn, the caller holds m_writeLock with nothing left to apply
+		size_t removeRows(const std::function<bool(const Serialization::Serializable*)>& predicate);
+		void checkpointIfDue();
+		// the caller holds m_lock
+		bool readSlot(std::string_view primaryKey, std::string& dest) const;
+		// readSlot through the row cache, for reads by key that are likely to come again
+		bool readCached(std::string_view primaryKey, std::string& dest) const;
+		void indexRow(std::span<const std::string_view> fields, const std::string& primaryKey);
+		void unindexRow(std::span<const std::string_view> fields, const std::string& primaryKey);
+		void filterRange(std::string_view data, const Snapshot& snapshot, const std::vector<size_t>& columnsIndexes, const std::function<bool(const Serialization::Serializable*)>& predicate, const std::function<bool(std::string_view)>& rowFilter, ResultSet& result);
+		void filterRangeBatch(std::string_view data, const Snapshot& snapshot, const std::vector<size_t>& columnsIndexes, const query::CompiledExpression& expression, const std::function<bool(std::string_view)>& rowFilter, ResultSet& result);
+		ResultSet scanChunks(std::string_view data, const query::ScanOptions& options, const std::function<void(std::string_view, ResultSet&)>& scanRange);
 	public:
 		Cursor(fileIO::FileStream& fileStream , Serialization::Deserializer& deserializer , Serialization::Serializer& serializer, Serialization::FormatDescriptor& fd);
+		// a copy shares the file but not the locks, two copies must not be used at the same time
+		Cursor(const Cursor& other);
+		// saves the key map when it changed and no other copy wrote since, see saveKeyIndex
+		~Cursor() noexcept;
 		Cursor& operator=(const Cursor& other) {
 			if (this != &other) {
 				// ... implement the assignment logic ...
@@ -254,31 +1321,195 @@ namespace table {
 			return *this;
 		}
 		std::vector<std::string> getPrimaryKeys();
+		const char* getPath() const noexcept {
+			return m_fileStream.getPath();
+		}
+		// bumped by every write, tells copies of the table data when they went stale
+		uint64_t version() const noexcept {
+			return m_version.load();
+		}
+		// a consistent view for a scan, taking it waits for a write being applied but the scan itself blocks no writer
+		Snapshot snapshot() const;
 		bool primaryKeyIsInside(const char* primaryKey)const noexcept;
-		std::vector<Serialization::Serializable*> filterFields(const std::vector<size_t>& columnsIndexes, std::function<bool(const Serialization::Serializable*)>);
+		bool readRow(const std::string& primaryKey, std::string& dest);
+		// rowFilter, when set, runs first on the stored row and spares the split of every row it rejects
+		ResultSet filterFields(const std::vector<size_t>& columnsIndexes, std::function<bool(const Serialization::Serializable*)>, const std::function<bool(std::string_view)>& rowFilter = {});
+		RowStream streamRows(const std::vector<size_t>& columnsIndexes, std::function<bool(const Serialization::Serializable*)> predicate, std::function<bool(std::string_view)> rowFilter = {});
+		// splits the file into row aligned chunks scanned on the shared thread pool, see query::ScanOptions for the predicate contract
+		ResultSet filterFieldsParallel(const std::vector<size_t>& columnsIndexes, std::function<bool(const Serialization::Serializable*)>, const query::ScanOptions& options, const std::function<bool(std::string_view)>& rowFilter = {});
+		// filterFieldsParallel for a compiled expression, rows are tested a block at a time instead of one by one
+		ResultSet filterFieldsBatch(const std::vector<size_t>& columnsIndexes, const query::CompiledExpression& expression, const query::ScanOptions& options, const std::function<bool(std::string_view)>& rowFilter = {});
+		// see Serialization::Deserializer::equalityFilter
+		std::function<bool(std::string_view)> equalityFilter(size_t column, std::string_view value) const;
+		ResultSet findByPrimaryKey(const std::string& primaryKey, const std::vector<size_t>& columnsIndexes);
+		// reads the rows of the given keys and keeps the ones the predicate accepts
+		ResultSet findByKeys(const std::vector<std::string>& primaryKeys, const std::vector<size_t>& columnsIndexes, const std::function<bool(const Serialization::Serializable*)>& predicate);
+		bool createIndex(size_t column, IndexKind kind);
+		size_t rowCount() const;
+		// heap memory the primary key index holds
+		size_t keyIndexBytes() const;
+		// caches up to capacityBytes of rows read by primary key, 0 turns the cache off, a copy of the cursor starts with an empty one
+		void setRowCache(size_t capacityBytes);
+		RowCache::Counters rowCacheCounters() const;
+		// the pointer is only safe to use while no other thread writes to the table
+		const SecondaryIndex* getIndex(size_t column) const noexcept;
+		// keys an index holds for values from..to, nullopt without an index on the column or, for a range, without an ordered one
+		std::optional<std::vector<std::string>> indexKeys(size_t column, const std::string& from, const std::string& to) const;
+		ResultSet findByIndex(size_t column, const std::string& value, const std::vector<size_t>& columnsIndexes);
+		// matching rows in the byte order of column, read off the key map or an ordered index until limit rows are found
+		// nullopt when the column is neither the primary key nor carries an ordered index
+		std::optional<ResultSet> findInOrder(size_t column, bool descending, size_t offset, std::optional<size_t> limit, const std::vector<size_t>& columnsIndexes, const std::function<bool(const Serialization::Serializable*)>& predicate);
+		// replays the log into the table, from then on every write is logged before it is applied
+		void attachLog(wal::WriteAheadLog& log);
+		// loads or builds the column files, from then on every write is appended to them as well
+		bool attachColumnStore(std::shared_ptr<ColumnStore> store);
+		std::shared_ptr<ColumnStore> columnStore() const;
+		// makes the table file durable and empties the log
+		bool checkpoint();
+		// writes the key map next to the table, the next open loads it instead of reading every row
+		// it is stamped with the table's size, modification time and a checksum of its last bytes, any change to the table voids it
+		bool saveKeyIndex();
 		void insertRows(std::vector<Serialization::Serializable*>content);
+		// inserts every row next() hands out until it returns nullptr, rows whose key is taken are skipped
+		// the rows bypass the log and are synced with the table file instead, other writers wait for the whole load
+		// a failed write is cut back off the file and ends the load, the rows of earlier writes stay loaded
+		BulkLoadResult bulkLoad(const std::function<Serialization::Serializable*()>& next, const BulkLoadOptions& options = BulkLoadOptions());
+		BulkLoadResult bulkLoad(const std::vector<Serialization::Serializable*>& content, const BulkLoadOptions& options = BulkLoadOptions());
 		void updateRow(Serialization::Serializable* newItem);
-		void deleteRows(std::function<bool(const Serialization::Serializable*)>);
+		// returns how many rows were removed, 0 when the file could not be rewritten
+		size_t deleteRows(std::function<bool(const Serialization::Serializable*)>);
 	};
 
+
+	// column oriented copy of a table, one file per column holding length prefixed values
+	// rows line up by position across the files, every write the cursor applies appends the row to all of them
+	// a replaced row leaves its old position dead, a delete writes the files anew with the survivors only
+	class ColumnStore {
+	private:
+		std::string m_basePath;
+		size_t m_columnCount = 0;
+		// key to its current position, the offset of the location is the position
+		KeyIndex m_positions;
+		std::vector<bool> m_live;
+		std::vector<std::ofstream> m_files;
+		// the files and positions of a delete in progress
+		std::vector<std::ofstream> m_rewriteFiles;
+		KeyIndex m_rewritePositions;
+		size_t m_rewriteCount = 0;
+		// set once the files may no longer match the table, scans fall back to the row file
+		bool m_damaged = false;
+		// appends come under the cursor's exclusive lock, scans only share it
+		mutable std::mutex m_lock;
+		std::string columnPath(size_t column) const;
+		std::string manifestPath() const;
+		// size and modification time of the row file, the manifest keeps the ones the columns were last written against
+		static std::string sourceStamp(const char* sourcePath);
+		bool openFiles();
+		static void appendValues(std::vector<std::ofstream>& files, std::span<const std::string_view> fields);
+	public:
+		ColumnStore(std::string basePath, size_t columnCount) : m_basePath(std::move(basePath)), m_columnCount(columnCount) {}
+		ColumnStore(const ColumnStore&) = delete;
+		ColumnStore& operator=(const ColumnStore&) = delete;
+		// leaves the manifest that lets the next run pick the files up
+		~ColumnStore();
+		// picks up column files left by an earlier run if the row file has not changed since, the manifest is gone until the store closes
+		bool load(const Cursor& cursor);
+		bool build(Cursor& cursor);
+		// the caller holds the cursor's m_lock exclusively
+		void append(std::span<const std::string_view> fields, std::string_view primaryKey);
+		// a delete streams its survivors in and commits them once the row file was replaced, the caller holds the cursor's m_writeLock
+		bool beginRewrite();
+		void rewriteRow(std::span<const std::string_view> fields);
+		// keep false throws the survivors away, the caller holds the cursor's m_lock exclusively when keeping them
+		bool endRewrite(bool keep);
+		size_t rowCount() const;
+		// reads only the files of the needed columns, the predicate sees the others as empty
+		// nullopt when the files could not be kept up with the table
+		std::optional<ResultSet> scan(const std::vector<size_t>& neededColumns, const std::vector<size_t>& columnsIndexes, const std::function<bool(const Serialization::Serializable*)>& predicate);
+	};
 	
+	// one table may be queried from any number of threads, reads run side by side and writes go one at a time
 	class Table {
 
 	private: 
+		friend class Transaction;
 		Cursor m_cursor;
 		std::vector<std::string> m_columnNames;
+		std::vector<Serialization::ColumnType> m_columnTypes;
 		std::string m_name;
+		std::optional<size_t> columnIndex(const std::string& columnName) const noexcept;
+		bool resolvePredicate(query::Predicate& predicate) const;
+		// keys of the rows a compiled expression can match, when the primary key or an index narrows them down
+		std::optional<std::vector<std::string>> candidateKeys(const query::CompiledExpression& expression) const;
+		// SELECTs whose predicate declares the columns it reads, served from the column files
+		std::optional<ResultSet> selectColumns(const std::vector<size_t>& columnsIndexes, const query::Predicate& predicate);
+		// hash join against the inner table, whose rows come from its key or index when only a few are needed
+		std::optional<ResultSet> join(query::Query& query);
+		// folds the matching rows into one entry per group as they stream by, memory grows with the groups only
+		std::optional<ResultSet> aggregate(query::Query& query);
+		// true when the key or an index picks the matching rows, so they are few and never need a scan
+		bool narrowed(const query::Predicate& predicate) const;
+		// ORDER BY and LIMIT, a bounded heap during the scan or a walk over an ordered index
+		std::optional<ResultSet> selectOrdered(query::Query& query, const std::vector<size_t>& columnsIndexes);
 	public:
-		Table(Cursor& cursor, std::vector<std::string> columnNames, const char* tableName);
-		std::optional<std::vector<Serialization::Serializable* >> executeQuery(query::Query& query);
+		// columns without a type are TEXT
+		Table(Cursor& cursor, std::vector<std::string> columnNames, const char* tableName, std::vector<Serialization::ColumnType> columnTypes = std::vector<Serialization::ColumnType>());
+		Table(const Table& other) : m_cursor(other.m_cursor), m_columnNames(other.m_columnNames), m_columnTypes(other.m_columnTypes), m_name(other.m_name) {}
+		bool createIndex(const std::string& columnName, IndexKind kind = HASH);
+		// keeps a column oriented copy next to the table file so a SELECT only reads the columns it touches
+		bool createColumnStore();
+		std::optional<ResultSet> executeQuery(query::Query& query);
+		// see Cursor::setRowCache
+		void setRowCache(size_t capacityBytes);
+		RowCache::Counters rowCacheCounters() const;
+		// see Cursor::bulkLoad, for seeding a table far faster than INSERT queries
+		BulkLoadResult bulkLoad(const std::function<Serialization::Serializable*()>& next, const BulkLoadOptions& options = BulkLoadOptions());
+		// lazily walks the rows a SELECT matches, nothing is materialized up front
+		RowStream executeStream(query::Query& query);
+		// stops at the first matching row
+		bool exists(query::Query& query);
 		Table& operator=(const Table& other) {
 			if (this != &other) {
 				// ... implement the assignment logic ...
 				m_cursor = other.m_cursor;
 				m_columnNames = other.m_columnNames;
+				m_columnTypes = other.m_columnTypes;
 				m_name = other.m_name;
 			}
 			return *this;
 		}
 	};
+
+	// writes to several tables that commit together, the whole transaction costs one log flush
+	// the tables written to have to share one write ahead log, a crash then keeps all of the writes or none
+	// nothing is written before commit, dropping the transaction or calling rollback discards it
+	class Transaction {
+	private:
+		struct Write {
+			Cursor* cursor;
+			wal::Operation operation;
+			std::string primaryKey;
+			std::string serialized;
+		};
+		// a key the transaction read, commit fails if it was added or removed since
+		struct Expectation {
+			Cursor* cursor;
+			std::string primaryKey;
+			bool present;
+		};
+		std::vector<Write> m_writes;
+		std::vector<Expectation> m_expectations;
+		bool m_finished = false;
+	public:
+		void insert(Table& table, Serialization::Serializable* row);
+		void update(Table& table, Serialization::Serializable* row);
+		bool exists(Table& table, const std::string& primaryKey);
+		// false when a read changed, a key collides or is gone, or the log could not be written
+		bool commit();
+		void rollback() noexcept;
+	};
+
+	// rewrites a table file in another format, dead rows and older copies of a key are dropped on the way
+	bool convertTable(const char* sourcePath, Serialization::Deserializer& sourceDeserializer, Serialization::FormatDescriptor& sourceFormat,
+		const char* destinationPath, Serialization::Serializer& destinationSerializer, Serialization::FormatDescriptor& destinationFormat);
 }
\ No newline at end of file
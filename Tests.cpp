@@ -0,0 +1,496 @@
+#include <filesystem>
+#include <fstream>
+#include <iostream>
+#include "Database.h"
+
+// Crash recovery and on-disk state of the storage engine.
+// Every test works on fresh files in its own directory under the system temp directory.
+// Run with a test name to run only that test, ctest runs each one on its own.
+
+namespace {
+
+    int failures = 0;
+
+#define CHECK(condition) \
+    do { \
+        if (!(condition)) { \
+            std::cerr << __FILE__ << ":" << __LINE__ << ": check failed: " #condition << std::endl; \
+            failures++; \
+        } \
+    } while (false)
+
+    // stops the test, what follows depends on it
+#define REQUIRE(condition) \
+    do { \
+        if (!(condition)) { \
+            std::cerr << __FILE__ << ":" << __LINE__ << ": requirement failed: " #condition << std::endl; \
+            failures++; \
+            return; \
+        } \
+    } while (false)
+
+    class Row : public Serialization::Serializable {
+    private:
+        std::vector<std::string> m_fields;
+    public:
+        Row(std::vector<std::string> fields) : m_fields(std::move(fields)) {}
+        std::vector<std::string> getContent() const noexcept override {
+            return m_fields;
+        }
+        std::string getPrimaryKey() const override {
+            return m_fields.front();
+        }
+    };
+
+    // the stream keeps a pointer to the path, so the path lives next to it
+    struct OpenTable {
+        std::string path;
+        fileIO::FileStream stream;
+        Serialization::Deserializer deserializer;
+        Serialization::Serializer serializer;
+        Serialization::FormatDescriptor fd;
+        table::Cursor cursor;
+        explicit OpenTable(std::string tablePath)
+            : path(std::move(tablePath)), stream(path.c_str(), "test"), cursor(stream, deserializer, serializer, fd) {}
+    };
+
+    // the directory of one test, emptied when the test starts and removed when it ends
+    class Scratch {
+    private:
+        std::filesystem::path m_directory;
+    public:
+        explicit Scratch(const std::string& testName) : m_directory(std::filesystem::temp_directory_path() / "database-tests" / testName) {
+            std::filesystem::remove_all(m_directory);
+            std::filesystem::create_directories(m_directory);
+        }
+        ~Scratch() {
+            std::error_code error;
+            std::filesystem::remove_all(m_directory, error);
+        }
+
+        std::string path(const std::string& name) const {
+            return (m_directory / name).string();
+        }
+        // a table of id,value rows for ids 0..rows-1
+        std::string writeTable(const std::string& name, size_t rows) const {
+            std::ofstream out(path(name), std::ios::binary);
+            for (size_t i = 0; i < rows; i++) {
+                out << i << ",value" << i << "\n";
+            }
+            return path(name);
+        }
+    };
+
+    // a COMMIT record carries no scope, key or payload
+    constexpr size_t commitRecordSize = sizeof(uint32_t) * 2 + sizeof(uint64_t) * 2 + 1 + sizeof(uint32_t) * 2;
+
+    std::string readFile(const std::string& filePath) {
+        std::ifstream in(filePath, std::ios::binary);
+        return std::string(std::istreambuf_iterator<char>(in), std::istreambuf_iterator<char>());
+    }
+
+    std::string serialized(const std::vector<std::string>& fields) {
+        Serialization::Serializer serializer;
+        Serialization::FormatDescriptor fd;
+        Row row(fields);
+        return serializer.serialize(&row, &fd);
+    }
+
+    bool hasRow(table::Cursor& cursor, const std::string& key, const std::string& value) {
+        std::string row;
+        return cursor.readRow(key, row) && row.find(value) != std::string::npos;
+    }
+
+    void replayStopsAtTornRecord(Scratch& scratch) {
+        auto table = scratch.writeTable("trips.csv", 10);
+        auto logPath = scratch.path("trips.wal");
+        {
+            wal::GroupCommitPolicy policy;
+            policy.sync = false;
+            wal::WriteAheadLog log(logPath, policy);
+            uint64_t lsn = 0;
+            for (int i = 100; i < 105; i++) {
+                lsn = log.append(wal::INSERT, table, std::to_string(i), serialized({ std::to_string(i), "logged" + std::to_string(i) }));
+            }
+            REQUIRE(log.waitDurable(lsn));
+        }
+        // the crash hit while the last record was being written
+        std::filesystem::resize_file(logPath, std::filesystem::file_size(logPath) - 3);
+
+        wal::WriteAheadLog log(logPath);
+        OpenTable open(table);
+        open.cursor.attachLog(log);
+        CHECK(open.cursor.rowCount() == 14u);
+        for (int i = 100; i < 104; i++) {
+            CHECK(hasRow(open.cursor, std::to_string(i), "logged" + std::to_string(i)));
+        }
+        std::string row;
+        CHECK(!open.cursor.readRow("104", row));
+        // the replayed rows are in the table, the log was emptied
+        CHECK(log.size() == 0u);
+        CHECK(log.readAll().empty());
+    }
+
+    void tornTailIsCutOffBeforeAppends(Scratch& scratch) {
+        auto logPath = scratch.path("users.wal");
+        wal::GroupCommitPolicy policy;
+        policy.sync = false;
+        {
+            wal::WriteAheadLog log(logPath, policy);
+            uint64_t lsn = 0;
+            for (int i = 0; i < 3; i++) {
+                lsn = log.append(wal::INSERT, "users", std::to_string(i), serialized({ std::to_string(i), "first" }));
+            }
+            REQUIRE(log.waitDurable(lsn));
+        }
+        std::filesystem::resize_file(logPath, std::filesystem::file_size(logPath) - 3);
+        {
+            wal::WriteAheadLog log(logPath, policy);
+            REQUIRE(log.is_open());
+            REQUIRE(log.readAll().size() == 2u);
+            REQUIRE(log.waitDurable(log.append(wal::INSERT, "users", "3", serialized({ "3", "after the crash" }))));
+        }
+        // the record appended after the crash is read back, not lost behind the torn one
+        wal::WriteAheadLog log(logPath, policy);
+        auto records = log.readAll();
+        REQUIRE(records.size() == 3u);
+        CHECK(records[0].key == "0");
+        CHECK(records[1].key == "1");
+        CHECK(records[2].key == "3");
+        CHECK(records[2].lsn > records[1].lsn);
+    }
+
+    void transactionWithoutCommitIsDropped(Scratch& scratch) {
+        auto table = scratch.writeTable("bookings.csv", 5);
+        auto logPath = scratch.path("bookings.wal");
+        {
+            wal::GroupCommitPolicy policy;
+            policy.sync = false;
+            wal::WriteAheadLog log(logPath, policy);
+            log.append(wal::UPDATE, table, "1", serialized({ "1", "alone" }));
+            uint64_t lsn = log.appendTransaction({
+                wal::Record{ 0, 0, wal::INSERT, table, "50", serialized({ "50", "first" }) },
+                wal::Record{ 0, 0, wal::UPDATE, table, "2", serialized({ "2", "second" }) } });
+            REQUIRE(log.waitDurable(lsn));
+        }
+        std::filesystem::resize_file(logPath, std::filesystem::file_size(logPath) - commitRecordSize);
+
+        wal::WriteAheadLog log(logPath);
+        OpenTable open(table);
+        open.cursor.attachLog(log);
+        CHECK(hasRow(open.cursor, "1", "alone"));
+        CHECK(hasRow(open.cursor, "2", "value2"));
+        std::string row;
+        CHECK(!open.cursor.readRow("50", row));
+        CHECK(open.cursor.rowCount() == 5u);
+    }
+
+    void interruptedTransactionStaysDropped(Scratch& scratch) {
+        auto table = scratch.writeTable("bookings.csv", 5);
+        auto logPath = scratch.path("bookings.wal");
+        wal::GroupCommitPolicy policy;
+        policy.sync = false;
+        {
+            wal::WriteAheadLog log(logPath, policy);
+            uint64_t lsn = log.appendTransaction({ wal::Record{ 0, 0, wal::INSERT, table, "50", serialized({ "50", "lost" }) } });
+            REQUIRE(log.waitDurable(lsn));
+        }
+        std::filesystem::resize_file(logPath, std::filesystem::file_size(logPath) - commitRecordSize);
+        {
+            wal::WriteAheadLog log(logPath, policy);
+            // the records of the transaction went with the COMMIT they lost
+            CHECK(log.size() == 0u);
+            OpenTable open(table);
+            open.cursor.attachLog(log);
+            std::string row;
+            CHECK(!open.cursor.readRow("50", row));
+            uint64_t lsn = log.appendTransaction({ wal::Record{ 0, 0, wal::INSERT, table, "60", serialized({ "60", "kept" }) } });
+            REQUIRE(log.waitDurable(lsn));
+        }
+        // the later COMMIT closes its own transaction only
+        wal::WriteAheadLog log(logPath, policy);
+        OpenTable open(table);
+        open.cursor.attachLog(log);
+        CHECK(hasRow(open.cursor, "60", "kept"));
+        std::string row;
+        CHECK(!open.cursor.readRow("50", row));
+    }
+
+    void commitClosesOnlyItsOwnTransaction(Scratch& scratch) {
+        auto table = scratch.writeTable("trips.csv", 5);
+        auto logPath = scratch.path("trips.wal");
+        wal::GroupCommitPolicy policy;
+        policy.sync = false;
+        // a transaction that lost its COMMIT followed straight by one that kept it, as no crash cut it off
+        {
+            wal::WriteAheadLog log(logPath, policy);
+            uint64_t lsn = log.appendTransaction({ wal::Record{ 0, 0, wal::INSERT, table, "50", serialized({ "50", "lost" }) } });
+            REQUIRE(log.waitDurable(lsn));
+        }
+        auto interrupted = readFile(logPath);
+        interrupted.resize(interrupted.size() - commitRecordSize);
+
+        auto otherPath = scratch.path("other.wal");
+        std::string committed;
+        {
+            // the first record only moves the sequence numbers past the interrupted transaction's
+            wal::WriteAheadLog log(otherPath, policy);
+            REQUIRE(log.waitDurable(log.append(wal::UPDATE, table, "1", serialized({ "1", "skipped" }))));
+            auto start = std::filesystem::file_size(otherPath);
+            uint64_t lsn = log.appendTransaction({ wal::Record{ 0, 0, wal::INSERT, table, "60", serialized({ "60", "kept" }) } });
+            REQUIRE(log.waitDurable(lsn));
+            committed = readFile(otherPath).substr(start);
+        }
+        {
+            std::ofstream out(logPath, std::ios::binary | std::ios::trunc);
+            out << interrupted << committed;
+        }
+
+        wal::WriteAheadLog log(logPath, policy);
+        auto records = log.readAll();
+        REQUIRE(records.size() == 1u);
+        CHECK(records[0].key == "60");
+        OpenTable open(table);
+        open.cursor.attachLog(log);
+        CHECK(hasRow(open.cursor, "60", "kept"));
+        std::string row;
+        CHECK(!open.cursor.readRow("50", row));
+    }
+
+    void deleteIsReplayedFromSharedLog(Scratch& scratch) {
+        auto trips = scratch.writeTable("trips.csv", 5);
+        auto bookings = scratch.writeTable("bookings.csv", 5);
+        auto logPath = scratch.path("shared.wal");
+        wal::GroupCommitPolicy policy;
+        policy.sync = false;
+        {
+            wal::WriteAheadLog log(logPath, policy);
+            OpenTable open(bookings);
+            open.cursor.attachLog(log);
+            Row booking({ "50", "booked" });
+            open.cursor.insertRows({ &booking });
+        }
+        {
+            // the bookings table has not replayed its record, so the log cannot be emptied
+            wal::WriteAheadLog log(logPath, policy);
+            OpenTable open(trips);
+            open.cursor.attachLog(log);
+            Row trip({ "5", "inserted" });
+            open.cursor.insertRows({ &trip });
+            REQUIRE(hasRow(open.cursor, "5", "inserted"));
+            CHECK(open.cursor.deleteRows([](const Serialization::Serializable* row) { return row->getPrimaryKey() == "5"; }) == 1u);
+            CHECK(!open.cursor.checkpoint());
+        }
+        wal::WriteAheadLog log(logPath, policy);
+        OpenTable openTrips(trips);
+        openTrips.cursor.attachLog(log);
+        std::string row;
+        CHECK(!openTrips.cursor.readRow("5", row));
+        CHECK(openTrips.cursor.rowCount() == 5u);
+        OpenTable openBookings(bookings);
+        openBookings.cursor.attachLog(log);
+        CHECK(hasRow(openBookings.cursor, "50", "booked"));
+    }
+
+    void logOfAnotherVersionIsRefused(Scratch& scratch) {
+        auto logPath = scratch.path("old.wal");
+        {
+            std::ofstream out(logPath, std::ios::binary);
+            out << "not a log this version wrote";
+        }
+        auto before = readFile(logPath);
+        {
+            wal::WriteAheadLog log(logPath);
+            CHECK(!log.is_open());
+            CHECK(log.readAll().empty());
+            CHECK(!log.waitDurable(log.append(wal::INSERT, "t", "k", "v")));
+        }
+        CHECK(readFile(logPath) == before);
+    }
+
+    void keyIndexRejectedAfterTableChanges(Scratch& scratch) {
+        auto table = scratch.writeTable("users.csv", 100);
+        auto keys = table + ".keys";
+        {
+            OpenTable open(table);
+            CHECK(open.cursor.rowCount() == 100u);
+        }
+        REQUIRE(std::filesystem::exists(keys));
+
+        // the same size and modification time, only the bytes of the last row differ
+        auto modified = std::filesystem::last_write_time(table);
+        auto content = readFile(table);
+        auto last = content.rfind("99,value99");
+        REQUIRE(last != std::string::npos);
+        content.replace(last, 2, "xx");
+        {
+            std::ofstream out(table, std::ios::binary | std::ios::trunc);
+            out << content;
+        }
+        std::filesystem::last_write_time(table, modified);
+
+        {
+            OpenTable open(table);
+            CHECK(hasRow(open.cursor, "xx", "value99"));
+            std::string row;
+            CHECK(!open.cursor.readRow("99", row));
+        }
+        // the index saved on close describes the table as it is now
+        OpenTable open(table);
+        CHECK(hasRow(open.cursor, "xx", "value99"));
+        CHECK(open.cursor.rowCount() == 100u);
+    }
+
+    void staleCopyLeavesKeyIndexAlone(Scratch& scratch) {
+        auto table = scratch.writeTable("trips.csv", 20);
+        auto keys = table + ".keys";
+        {
+            OpenTable open(table);
+            {
+                table::Cursor writer(open.cursor);
+                Row grown({ "3", "a row that no longer fits in its slot" });
+                writer.updateRow(&grown);
+            }
+            REQUIRE(std::filesystem::exists(keys));
+            auto saved = readFile(keys);
+            auto size = std::filesystem::file_size(table);
+            // the original cursor missed the copy's write
+            CHECK(!open.cursor.saveKeyIndex());
+            CHECK(std::filesystem::file_size(table) == size);
+            CHECK(readFile(keys) == saved);
+        }
+        OpenTable open(table);
+        CHECK(hasRow(open.cursor, "3", "no longer fits"));
+        CHECK(open.cursor.rowCount() == 20u);
+    }
+
+    void pagePoolWritesBackOnFlushAndEviction(Scratch& scratch) {
+        auto table = scratch.path("pages.bin");
+        constexpr size_t pages = 16;
+        {
+            std::ofstream out(table, std::ios::binary);
+            out << std::string(pages * fileIO::PagePool::pageSize, '.');
+        }
+        fileIO::FileStream stream(table.c_str(), "pages");
+        stream.setPageBudget(4 * fileIO::PagePool::pageSize);
+
+        // a write to a resident page stays in memory until the flush
+        std::string dest;
+        REQUIRE(stream.readAt(0, 8, dest));
+        REQUIRE(stream.writeAt(2, "ab", 2));
+        CHECK(stream.readAt(0, 8, dest));
+        CHECK(dest == "..ab....");
+        REQUIRE(stream.flush());
+        CHECK(readFile(table).substr(0, 8) == "..ab....");
+
+        // more dirty pages than the budget holds, the evicted ones go back on their own
+        for (size_t page = 0; page < pages; page++) {
+            auto offset = static_cast<std::streamoff>(page * fileIO::PagePool::pageSize + 100);
+            REQUIRE(stream.readAt(offset, 1, dest));
+            REQUIRE(stream.writeAt(offset, "#", 1));
+        }
+        CHECK(stream.pageCounters().writebacks > 0u);
+        REQUIRE(stream.flush());
+        CHECK(stream.pageCounters().dirty == 0u);
+        auto content = readFile(table);
+        for (size_t page = 0; page < pages; page++) {
+            CHECK(content[page * fileIO::PagePool::pageSize + 100] == '#');
+        }
+    }
+
+    void columnFilesFollowWrites(Scratch& scratch) {
+        auto tablePath = scratch.writeTable("bookings.csv", 50);
+        auto select = [](table::Table& table, const std::string& value) {
+            auto query = query::QueryBuilder(query::SELECT).setTarget({ "id" }).whereEquals("value", value).build();
+            return table.executeQuery(query)->size();
+        };
+        {
+            OpenTable open(tablePath);
+            table::Table bookings(open.cursor, { "id", "value" }, "bookings");
+            REQUIRE(bookings.createColumnStore());
+            Row updated({ "7", "shared" });
+            Row inserted({ "70", "shared" });
+            auto update = query::QueryBuilder(query::UPDATE).setPayLoad({ &updated }).build();
+            auto insert = query::QueryBuilder(query::INSERT).setPayLoad({ &inserted }).build();
+            bookings.executeQuery(update);
+            bookings.executeQuery(insert);
+            CHECK(select(bookings, "shared") == 2u);
+            CHECK(select(bookings, "value7") == 0u);
+
+            auto remove = query::QueryBuilder(query::DELETE).whereEquals("id", "70").build();
+            bookings.executeQuery(remove);
+            CHECK(select(bookings, "shared") == 1u);
+        }
+        // the files are picked up again as they were left
+        auto column = readFile(tablePath + ".col0");
+        OpenTable open(tablePath);
+        table::Table bookings(open.cursor, { "id", "value" }, "bookings");
+        REQUIRE(bookings.createColumnStore());
+        CHECK(readFile(tablePath + ".col0") == column);
+        CHECK(select(bookings, "shared") == 1u);
+    }
+
+    void conversionKeepsLastCopyOfKey(Scratch& scratch) {
+        auto source = scratch.writeTable("users.csv", 5);
+        {
+            // a row replaced while a snapshot was open, the crash came before its old copy was tombstoned
+            std::ofstream out(source, std::ios::binary | std::ios::app);
+            out << "3,replaced\n";
+        }
+        auto destination = scratch.path("users.bin");
+        Serialization::Deserializer textDeserializer;
+        Serialization::FormatDescriptor textFormat;
+        Serialization::BinarySerializer binarySerializer;
+        Serialization::BinaryFormatDescriptor binaryFormat;
+        REQUIRE(table::convertTable(source.c_str(), textDeserializer, textFormat, destination.c_str(), binarySerializer, binaryFormat));
+        CHECK(readFile(destination).find("value3") == std::string::npos);
+
+        fileIO::FileStream stream(destination.c_str(), "users");
+        Serialization::BinaryDeserializer deserializer;
+        table::Cursor cursor(stream, deserializer, binarySerializer, binaryFormat);
+        CHECK(cursor.rowCount() == 5u);
+        CHECK(hasRow(cursor, "3", "replaced"));
+    }
+
+    struct Test {
+        const char* name;
+        void (*run)(Scratch& scratch);
+    };
+
+    const Test tests[] = {
+        { "replayStopsAtTornRecord", replayStopsAtTornRecord },
+        { "tornTailIsCutOffBeforeAppends", tornTailIsCutOffBeforeAppends },
+        { "transactionWithoutCommitIsDropped", transactionWithoutCommitIsDropped },
+        { "interruptedTransactionStaysDropped", interruptedTransactionStaysDropped },
+        { "commitClosesOnlyItsOwnTransaction", commitClosesOnlyItsOwnTransaction },
+        { "deleteIsReplayedFromSharedLog", deleteIsReplayedFromSharedLog },
+        { "logOfAnotherVersionIsRefused", logOfAnotherVersionIsRefused },
+        { "keyIndexRejectedAfterTableChanges", keyIndexRejectedAfterTableChanges },
+        { "staleCopyLeavesKeyIndexAlone", staleCopyLeavesKeyIndexAlone },
+        { "pagePoolWritesBackOnFlushAndEviction", pagePoolWritesBackOnFlushAndEviction },
+        { "columnFilesFollowWrites", columnFilesFollowWrites },
+        { "conversionKeepsLastCopyOfKey", conversionKeepsLastCopyOfKey },
+    };
+
+}
+
+int main(int argc, char** argv) {
+    size_t ran = 0;
+    for (const auto& test : tests) {
+        if (argc > 1 && std::string(argv[1]) != test.name) {
+            continue;
+        }
+        int before = failures;
+        {
+            Scratch scratch(test.name);
+            test.run(scratch);
+        }
+        std::cout << (failures == before ? "passed " : "FAILED ") << test.name << std::endl;
+        ran++;
+    }
+    if (ran == 0) {
+        std::cerr << "No test named " << (argc > 1 ? argv[1] : "") << std::endl;
+        return 1;
+    }
+    return failures == 0 ? 0 : 1;
+}
@@ -0,0 +1,432 @@
+#include "WriteAheadLog.h"
+#include <iostream>
+#include <fstream>
+#include <cstring>
+#include <algorithm>
+#include <iterator>
+#ifdef _WIN32
+#define WIN32_LEAN_AND_MEAN
+#define NOMINMAX
+#include <windows.h>
+#else
+#include <fcntl.h>
+#include <unistd.h>
+#endif
+
+namespace {
+
+    // the file starts with the magic and the version of the record layout, a log of another version is never replayed
+    constexpr char logMagic[8] = { 'W', 'R', 'I', 'T', 'E', 'L', 'O', 'G' };
+    constexpr uint32_t logVersion = 1;
+    constexpr size_t fileHeaderSize = sizeof(logMagic) + sizeof(uint32_t);
+
+    // record layout: length, checksum, lsn, transaction, operation, scope length, scope, key length, key, payload
+    // length and checksum cover everything after the checksum
+    constexpr size_t headerSize = sizeof(uint32_t) * 2;
+    constexpr size_t fixedSize = sizeof(uint64_t) * 2 + 1 + sizeof(uint32_t) * 2;
+
+    uint32_t checksum(const char* data, size_t size) {
+        // FNV-1a, enough to spot a torn or garbled tail
+        uint32_t hash = 2166136261u;
+        for (size_t i = 0; i < size; i++) {
+            hash ^= static_cast<unsigned char>(data[i]);
+            hash *= 16777619u;
+        }
+        return hash;
+    }
+
+    template<typename T>
+    void put(std::string& out, T value) {
+        out.append(reinterpret_cast<const char*>(&value), sizeof(T));
+    }
+
+    template<typename T>
+    T get(const char* data) {
+        T value;
+        std::memcpy(&value, data, sizeof(T));
+        return value;
+    }
+
+    // the committed records after the file header, returns where the log should end
+    // anything past that was torn by a crash or belongs to a transaction the crash cut short
+    size_t parseRecords(const std::string& content, std::vector<wal::Record>& records, uint64_t& lastLsn) {
+        // records of a transaction are held back until its COMMIT shows up
+        std::vector<wal::Record> open;
+        uint64_t openTransaction = 0;
+        size_t openStart = 0;
+        size_t position = fileHeaderSize;
+        while (position + headerSize <= content.size()) {
+            uint32_t length = get<uint32_t>(content.data() + position);
+            uint32_t expected = get<uint32_t>(content.data() + position + sizeof(uint32_t));
+            const char* body = content.data() + position + headerSize;
+            if (length < fixedSize || position + headerSize + length > content.size() || checksum(body, length) != expected) {
+                // the crash happened while this record was being written
+                break;
+            }
+
+            wal::Record record;
+            const char* field = body;
+            record.lsn = get<uint64_t>(field);
+            field += sizeof(uint64_t);
+            record.transaction = get<uint64_t>(field);
+            field += sizeof(uint64_t);
+            record.operation = static_cast<wal::Operation>(*field++);
+            uint32_t scopeLength = get<uint32_t>(field);
+            field += sizeof(uint32_t);
+            if (scopeLength > length - fixedSize) {
+                break;
+            }
+            record.scope.assign(field, scopeLength);
+            field += scopeLength;
+            uint32_t keyLength = get<uint32_t>(field);
+            field += sizeof(uint32_t);
+            if (keyLength > length - fixedSize - scopeLength) {
+                break;
+            }
+            record.key.assign(field, keyLength);
+            field += keyLength;
+            record.payload.assign(field, body + length - field);
+            lastLsn = record.lsn;
+            size_t start = position;
+            position += headerSize + length;
+
+            // a transaction's records are written back to back, one followed by anything else lost its COMMIT
+            if (!open.empty() && record.transaction != openTransaction) {
+                open.clear();
+            }
+            if (record.transaction == 0) {
+                records.push_back(std::move(record));
+            }
+            else if (record.operation == wal::COMMIT) {
+                std::move(open.begin(), open.end(), std::back_inserter(records));
+                open.clear();
+            }
+            else {
+                if (open.empty()) {
+                    openTransaction = record.transaction;
+                    openStart = start;
+                }
+                open.push_back(std::move(record));
+            }
+        }
+        // whatever is still open was cut off by the crash and never committed
+        return open.empty() ? position : openStart;
+    }
+
+}
+
+wal::WriteAheadLog::WriteAheadLog(const std::string& path, GroupCommitPolicy policy) : m_path(path), m_policy(policy)
+{
+#ifdef _WIN32
+    HANDLE handle = CreateFileA(m_path.c_str(), GENERIC_WRITE, FILE_SHARE_READ, nullptr, OPEN_ALWAYS, FILE_ATTRIBUTE_NORMAL, nullptr);
+    m_handle = handle == INVALID_HANDLE_VALUE ? nullptr : handle;
+#else
+    m_descriptor = ::open(m_path.c_str(), O_WRONLY | O_CREAT | O_APPEND, 0644);
+#endif
+    if (!is_open()) {
+        std::cerr << "Error opening log: " << m_path << std::endl;
+        return;
+    }
+    std::ifstream existing(m_path, std::ios::binary);
+    std::string content((std::istreambuf_iterator<char>(existing)), std::istreambuf_iterator<char>());
+    std::string header = content.substr(0, fileHeaderSize);
+    std::string expected(logMagic, sizeof(logMagic));
+    put<uint32_t>(expected, logVersion);
+    if (header == expected) {
+        // a torn record, or a transaction without its COMMIT, is cut off, records appended after it could never be read back
+        // and a later COMMIT must not pick it up
+        std::vector<Record> records;
+        uint64_t lastLsn = 0;
+        size_t end = parseRecords(content, records, lastLsn);
+        if (end < content.size() && !resize(end)) {
+            close();
+            return;
+        }
+        m_nextLsn = lastLsn + 1;
+        m_size = end - fileHeaderSize;
+        return;
+    }
+    // anything but a header cut short by a crash, which leaves no record behind, belongs to another version
+    if (expected.compare(0, header.size(), header) != 0) {
+        std::cerr << "Log " << m_path << " was written by another version, it is neither replayed nor appended to" << std::endl;
+        close();
+        return;
+    }
+    if (!resize(0) || !writeAndSync(expected)) {
+        std::cerr << "Error writing log: " << m_path << std::endl;
+        close();
+    }
+}
+
+wal::WriteAheadLog::~WriteAheadLog() noexcept
+{
+    // hand over whatever is still buffered
+    waitDurable(m_bufferedLsn);
+    close();
+}
+
+void wal::WriteAheadLog::close() noexcept
+{
+#ifdef _WIN32
+    if (m_handle != nullptr) {
+        CloseHandle(m_handle);
+        m_handle = nullptr;
+    }
+#else
+    if (m_descriptor >= 0) {
+        ::close(m_descriptor);
+        m_descriptor = -1;
+    }
+#endif
+}
+
+bool wal::WriteAheadLog::is_open() const noexcept
+{
+#ifdef _WIN32
+    return m_handle != nullptr;
+#else
+    return m_descriptor >= 0;
+#endif
+}
+
+void wal::WriteAheadLog::bufferRecord(uint64_t lsn, uint64_t transaction, Operation operation, std::string_view scope, std::string_view key, std::string_view payload)
+{
+    // the caller holds m_lock
+    uint32_t length = static_cast<uint32_t>(fixedSize + scope.size() + key.size() + payload.size());
+    size_t start = m_buffer.size();
+    put<uint32_t>(m_buffer, length);
+    put<uint32_t>(m_buffer, 0);
+    put<uint64_t>(m_buffer, lsn);
+    put<uint64_t>(m_buffer, transaction);
+    m_buffer.push_back(static_cast<char>(operation));
+    put<uint32_t>(m_buffer, static_cast<uint32_t>(scope.size()));
+    m_buffer.append(scope);
+    put<uint32_t>(m_buffer, static_cast<uint32_t>(key.size()));
+    m_buffer.append(key);
+    m_buffer.append(payload);
+
+    uint32_t sum = checksum(m_buffer.data() + start + headerSize, length);
+    std::memcpy(m_buffer.data() + start + sizeof(uint32_t), &sum, sizeof(sum));
+    m_bufferedLsn = lsn;
+}
+
+uint64_t wal::WriteAheadLog::append(Operation operation, std::string_view scope, std::string_view key, std::string_view payload)
+{
+    std::lock_guard<std::mutex> guard(m_lock);
+    uint64_t lsn = m_nextLsn++;
+    bufferRecord(lsn, 0, operation, scope, key, payload);
+    m_unapplied++;
+
+    if (m_buffer.size() >= m_policy.maxBatchBytes) {
+        m_batchFull.notify_one();
+    }
+    return lsn;
+}
+
+uint64_t wal::WriteAheadLog::appendTransaction(const std::vector<Record>& records)
+{
+    std::lock_guard<std::mutex> guard(m_lock);
+    // the transaction is named after its first record, nothing else can land between its records
+    uint64_t transaction = m_nextLsn;
+    for (const auto& record : records) {
+        bufferRecord(m_nextLsn++, transaction, record.operation, record.scope, record.key, record.payload);
+    }
+    uint64_t lsn = m_nextLsn++;
+    bufferRecord(lsn, transaction, COMMIT, {}, {}, {});
+    m_unapplied += records.size();
+
+    if (m_buffer.size() >= m_policy.maxBatchBytes) {
+        m_batchFull.notify_one();
+    }
+    return lsn;
+}
+
+bool wal::WriteAheadLog::waitDurable(uint64_t lsn)
+{
+    std::unique_lock<std::mutex> guard(m_lock);
+    while (m_durableLsn < lsn) {
+        if (m_flushing) {
+            // somebody is flushing, our record is either in that group or the next one
+            m_flushed.wait(guard);
+            continue;
+        }
+
+        // lead the next group
+        m_flushing = true;
+        if (m_policy.maxDelay.count() > 0) {
+            m_batchFull.wait_for(guard, m_policy.maxDelay, [this]() { return m_buffer.size() >= m_policy.maxBatchBytes; });
+        }
+        std::string batch;
+        batch.swap(m_buffer);
+        uint64_t batchLsn = m_bufferedLsn;
+
+        // appenders keep filling the next group while this one is written
+        guard.unlock();
+        bool written = writeAndSync(batch);
+        guard.lock();
+
+        m_flushing = false;
+        if (written) {
+            m_durableLsn = std::max(m_durableLsn, batchLsn);
+            m_size += batch.size();
+            m_groupCount++;
+        }
+        m_flushed.notify_all();
+        if (!written) {
+            return false;
+        }
+    }
+    return true;
+}
+
+bool wal::WriteAheadLog::writeAndSync(const std::string& batch)
+{
+    if (!is_open()) {
+        return false;
+    }
+    if (batch.empty()) {
+        return true;
+    }
+#ifdef _WIN32
+    DWORD written = 0;
+    LARGE_INTEGER end{};
+    SetFilePointerEx(m_handle, end, nullptr, FILE_END);
+    if (!WriteFile(m_handle, batch.data(), static_cast<DWORD>(batch.size()), &written, nullptr) || written != batch.size()) {
+        std::cerr << "Error writing log: " << m_path << std::endl;
+        return false;
+    }
+    if (m_policy.sync && !FlushFileBuffers(m_handle)) {
+        std::cerr << "Error syncing log: " << m_path << std::endl;
+        return false;
+    }
+#else
+    size_t done = 0;
+    while (done < batch.size()) {
+        ssize_t written = ::write(m_descriptor, batch.data() + done, batch.size() - done);
+        if (written < 0) {
+            std::cerr << "Error writing log: " << m_path << std::endl;
+            return false;
+        }
+        done += static_cast<size_t>(written);
+    }
+    if (m_policy.sync && ::fdatasync(m_descriptor) != 0) {
+        std::cerr << "Error syncing log: " << m_path << std::endl;
+        return false;
+    }
+#endif
+    return true;
+}
+
+std::vector<wal::Record> wal::WriteAheadLog::readAll()
+{
+    std::vector<Record> records;
+    // the constructor checked the header, a log it refused is never read
+    if (!is_open()) {
+        return records;
+    }
+    std::ifstream in(m_path, std::ios::binary);
+    std::string content((std::istreambuf_iterator<char>(in)), std::istreambuf_iterator<char>());
+    uint64_t lastLsn = 0;
+    parseRecords(content, records, lastLsn);
+
+    std::lock_guard<std::mutex> guard(m_lock);
+    m_nextLsn = std::max(m_nextLsn, lastLsn + 1);
+    return records;
+}
+
+std::vector<wal::Record> wal::WriteAheadLog::attach(const std::string& scope)
+{
+    auto records = readAll();
+    std::vector<Record> own;
+    std::set<std::string> present;
+    for (auto& record : records) {
+        if (record.scope == scope) {
+            own.push_back(std::move(record));
+        }
+        else {
+            present.insert(record.scope);
+        }
+    }
+
+    std::lock_guard<std::mutex> guard(m_lock);
+    m_scopes.insert(scope);
+    m_unreplayed.clear();
+    for (const auto& other : present) {
+        if (m_scopes.count(other) == 0) {
+            m_unreplayed.insert(other);
+        }
+    }
+    return own;
+}
+
+std::set<std::string> wal::WriteAheadLog::scopes()
+{
+    std::lock_guard<std::mutex> guard(m_lock);
+    return m_scopes;
+}
+
+void wal::WriteAheadLog::applied(size_t count)
+{
+    std::lock_guard<std::mutex> guard(m_lock);
+    m_unapplied -= std::min(count, m_unapplied);
+    m_appliedCount += count;
+}
+
+uint64_t wal::WriteAheadLog::appliedCount() noexcept
+{
+    std::lock_guard<std::mutex> guard(m_lock);
+    return m_appliedCount;
+}
+
+bool wal::WriteAheadLog::truncate(uint64_t applied)
+{
+    std::unique_lock<std::mutex> guard(m_lock);
+    if (!is_open()) {
+        return false;
+    }
+    // a group being written right now must not land in the emptied file
+    m_flushed.wait(guard, [this]() { return !m_flushing; });
+    // a table that is still applying, or was not replayed, has rows only the log holds
+    if (m_unapplied != 0 || m_appliedCount != applied || !m_unreplayed.empty()) {
+        return false;
+    }
+    // the header stays
+    if (!resize(fileHeaderSize)) {
+        return false;
+    }
+    m_size = 0;
+    return true;
+}
+
+bool wal::WriteAheadLog::resize(size_t length)
+{
+#ifdef _WIN32
+    FILE_END_OF_FILE_INFO end{};
+    end.EndOfFile.QuadPart = static_cast<LONGLONG>(length);
+    bool truncated = SetFileInformationByHandle(m_handle, FileEndOfFileInfo, &end, sizeof(end)) != 0;
+    if (truncated && m_policy.sync) {
+        FlushFileBuffers(m_handle);
+    }
+#else
+    bool truncated = ::ftruncate(m_descriptor, static_cast<off_t>(length)) == 0;
+    if (truncated && m_policy.sync) {
+        ::fsync(m_descriptor);
+    }
+#endif
+    if (!truncated) {
+        std::cerr << "Error truncating log: " << m_path << std::endl;
+    }
+    return truncated;
+}
+
+size_t wal::WriteAheadLog::size() noexcept
+{
+    std::lock_guard<std::mutex> guard(m_lock);
+    return m_size;
+}
+
+size_t wal::WriteAheadLog::groupCount() noexcept
+{
+    std::lock_guard<std::mutex> guard(m_lock);
+    return m_groupCount;
+}
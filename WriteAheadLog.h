@@ -0,0 +1,112 @@
+#pragma once
+#include <string>
+#include <string_view>
+#include <vector>
+#include <mutex>
+#include <condition_variable>
+#include <chrono>
+#include <cstdint>
+#include <set>
+
+namespace wal {
+
+	enum Operation : char {
+		INSERT = 'I',
+		UPDATE = 'U',
+		// a deleted row, the record carries the key only
+		REMOVE = 'D',
+		// closes the records of a transaction, without it they are dropped on replay
+		COMMIT = 'C'
+	};
+
+	struct Record {
+		uint64_t lsn;
+		// 0 for a write that commits on its own
+		uint64_t transaction;
+		Operation operation;
+		// the table the record belongs to, several tables may share one log
+		std::string scope;
+		std::string key;
+		std::string payload;
+	};
+
+	struct GroupCommitPolicy {
+		// how long the thread that flushes waits for others to join its group, 0 flushes right away
+		std::chrono::microseconds maxDelay{ 0 };
+		// a group is flushed early once this much is buffered
+		size_t maxBatchBytes = 1 << 20;
+		// false leaves durability to the OS page cache
+		bool sync = true;
+		// the table is checkpointed and the log emptied once it grows past this
+		size_t checkpointBytes = 64 << 20;
+	};
+
+	// append only redo log of one or more tables
+	// any number of threads append records and wait for them, each group of waiting records costs one fsync
+	class WriteAheadLog {
+	private:
+		std::string m_path;
+		GroupCommitPolicy m_policy;
+#ifdef _WIN32
+		void* m_handle = nullptr;
+#else
+		int m_descriptor = -1;
+#endif
+		std::mutex m_lock;
+		std::condition_variable m_flushed;
+		std::condition_variable m_batchFull;
+		std::string m_buffer;
+		uint64_t m_nextLsn = 1;
+		uint64_t m_bufferedLsn = 0;
+		uint64_t m_durableLsn = 0;
+		bool m_flushing = false;
+		size_t m_size = 0;
+		size_t m_groupCount = 0;
+		// records appended but not applied to their table yet, and how many were applied so far
+		size_t m_unapplied = 0;
+		uint64_t m_appliedCount = 0;
+		std::set<std::string> m_scopes;
+		// scopes with records in the file whose table has not attached and replayed them yet
+		std::set<std::string> m_unreplayed;
+
+		void bufferRecord(uint64_t lsn, uint64_t transaction, Operation operation, std::string_view scope, std::string_view key, std::string_view payload);
+		bool writeAndSync(const std::string& batch);
+		// cuts the file to length bytes, synced as the policy asks
+		bool resize(size_t length);
+		// a closed log takes no records, appends to it are never durable
+		void close() noexcept;
+	public:
+		WriteAheadLog(const std::string& path, GroupCommitPolicy policy = GroupCommitPolicy());
+		~WriteAheadLog() noexcept;
+		WriteAheadLog(const WriteAheadLog&) = delete;
+		WriteAheadLog& operator=(const WriteAheadLog&) = delete;
+
+		bool is_open() const noexcept;
+		const GroupCommitPolicy& getPolicy() const noexcept {
+			return m_policy;
+		}
+		// buffers a record and returns its log sequence number, nothing is written yet
+		uint64_t append(Operation operation, std::string_view scope, std::string_view key, std::string_view payload);
+		// buffers the records as one transaction closed by a COMMIT record and returns the COMMIT's sequence number
+		// they reach the file in the same group flush, a crash keeps all of them or none
+		uint64_t appendTransaction(const std::vector<Record>& records);
+		// blocks until every record up to lsn is on disk, joining or leading a group flush
+		bool waitDurable(uint64_t lsn);
+		// every intact committed record in the log, opening it already cut off a tail torn by a crash
+		std::vector<Record> readAll();
+		// registers the table writing as scope and hands back its records to replay
+		std::vector<Record> attach(const std::string& scope);
+		// the tables attached so far, their files must be durable before the log is emptied
+		std::set<std::string> scopes();
+		// called by a table once appended records reached it, whether they were applied or dropped
+		void applied(size_t count);
+		uint64_t appliedCount() noexcept;
+		// empties the log, refused while a record waits to be applied, a table has not replayed its records yet,
+		// or anything was applied since appliedCount returned applied
+		bool truncate(uint64_t applied);
+		// bytes of records in the file, the header not counted
+		size_t size() noexcept;
+		size_t groupCount() noexcept;
+	};
+
+}
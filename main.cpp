@@ -113,6 +113,7 @@ private:
                 currentUser = email;
                 showTrips();
                 bookTrip();
+                showBookings();
             }
         }
         catch (const AuthException& e) {
@@ -154,19 +155,35 @@ private:
         auto query = selectQuery.setTarget({ "tripId", "destination", "departureDate", "price" }).setPredicate([](const Serialization::Serializable*)->bool {
             return true;
             }).build();
-            auto result = tripsTable.executeQuery(query);
-
-            if (result) {
-                std::cout << "Available trips:\n";
-                for (const auto& trip : *result) {
-                    trip->cout();
+            // rows are printed as they are read, the table is never held in memory
+            bool anyTrip = false;
+            for (const auto& trip : tripsTable.executeStream(query)) {
+                if (!anyTrip) {
+                    std::cout << "Available trips:\n";
+                    anyTrip = true;
                 }
+                trip.cout();
             }
-            else {
+            if (!anyTrip) {
                 std::cout << "No trips available.\n";
             }
     }
 
+    void showBookings() {
+        // The user's bookings with the destination of each trip, in one query instead of one lookup per booking
+        auto query = query::QueryBuilder(query::Type::JOIN).setTarget({ "bookingId" }).whereEquals("userEmail", currentUser)
+            .join(tripsTable, "tripId", "tripId", { "destination", "departureDate" }).build();
+        auto bookings = bookingsTable.executeQuery(query);
+        if (!bookings || bookings->empty()) {
+            std::cout << "No bookings yet.\n";
+            return;
+        }
+        std::cout << "Your bookings:\n";
+        for (const auto& booking : *bookings) {
+            booking->cout();
+        }
+    }
+
     void bookTrip() {
         int tripId;
 
@@ -184,27 +201,27 @@ private:
             }
         }
 
-        // Check if the trip exists and is available
-        bool isFound = tripExists(tripId);
-       
-       
-        if(isFound) { 
+        // The trip check and the booking commit together, a trip removed in between fails the booking
+        table::Transaction booking;
+        if (booking.exists(tripsTable, std::to_string(tripId))) {
             // Create a new booking record
-             Booking newBooking(std::rand(), currentUser.c_str(), tripId);
+            Booking newBooking(std::rand(), currentUser.c_str(), tripId);
 
             // Add the new booking record to the 'bookings' table
-            addBooking(newBooking);
-            std::cout << "Booking successful!\n";
+            booking.insert(bookingsTable, &newBooking);
+            if (booking.commit()) {
+                std::cout << "Booking successful!\n";
+            }
+            else {
+                std::cout << "Booking failed, please try again.\n";
+            }
         }
 
     }
     bool isValidTripId(int tripId) {
         // Create a query to check if the tripId exists in the 'trips' table
         
-        auto query =query::QueryBuilder(query::Type::SELECT).setTarget({ "trip_id" }).setPredicate([tripId](const Serialization::Serializable* obj) -> bool {
-            
-            return obj->getPrimaryKey() == std::to_string(tripId);
-            }).build();
+        auto query =query::QueryBuilder(query::Type::SELECT).setTarget({ "trip_id" }).wherePrimaryKey(std::to_string(tripId)).build();
 
             // Execute the query on the 'trips' table
             auto result = tripsTable.executeQuery(query);
@@ -212,28 +229,6 @@ private:
             // Check if any matching record was found
             return result && !result->empty();
     }
-    void addBooking( Booking& booking) {
-        // Create a query to insert the booking into the 'bookings' table
-        query::QueryBuilder insertQuery(query::Type::INSERT);
-        auto query = insertQuery.setTarget({ "bookingId", "userEmail", "tripId" }).setPayLoad(std::vector<Serialization::Serializable*>{ &booking }).build();
-
-        // Execute the query on the 'bookings' table
-        bookingsTable.executeQuery(query);
-    }
-    bool tripExists(int tripId) {
-        // Create a query to check if a trip with the given tripId exists
-        
-        auto query = query::QueryBuilder(query::Type::SELECT).setTarget({ "tripId" }).setPredicate([tripId](const Serialization::Serializable* obj) -> bool {
-            const auto* trip = dynamic_cast<const Trip*>(obj); // Assuming Trip is the class representing a trip
-            return trip && std::stoi(trip->getPrimaryKey()) == tripId;
-            }).build();
-
-            // Execute the query on the 'trips' table
-            auto result = tripsTable.executeQuery(query);
-
-            // Check if the result contains any entries
-            return result && !result->empty();
-    }
 
 
 };
@@ -241,13 +236,21 @@ private:
 
 int main() {
    
+    // One log for all tables, so a booking touching several of them is made durable at once
+    wal::WriteAheadLog log("database.wal");
+
     // Initialize the trips table
     fileIO::FileStream tripsFileStream("trips.csv", "Trips");
     Serialization::Deserializer tripsDeserializer;
     Serialization::Serializer tripsSerializer;
     Serialization::FormatDescriptor tripsFormatDescriptor;
     table::Cursor tripsCursor(tripsFileStream, tripsDeserializer, tripsSerializer, tripsFormatDescriptor);
-    auto tripsTable = table::Table(tripsCursor, std::vector<std::string>{ "tripId", "destination", "departureDate", "price" }, "trips.csv");
+    tripsCursor.attachLog(log);
+    auto tripsTable = table::Table(tripsCursor, std::vector<std::string>{ "tripId", "destination", "departureDate", "price" }, "trips.csv",
+        { Serialization::INTEGER, Serialization::TEXT, Serialization::DATE, Serialization::DECIMAL });
+    tripsTable.createIndex("destination", table::ORDERED);
+    // trip pages are read far more often than trips change
+    tripsTable.setRowCache(4 << 20);
 
     // Initialize the bookings table
     fileIO::FileStream bookingsFileStream("bookings.csv", "Bookings");
@@ -255,7 +258,10 @@ int main() {
     Serialization::Serializer bookingsSerializer;
     Serialization::FormatDescriptor bookingsFormatDescriptor;
     table::Cursor bookingsCursor(bookingsFileStream, bookingsDeserializer, bookingsSerializer, bookingsFormatDescriptor);
-    auto bookingsTable = table::Table(bookingsCursor, std::vector<std::string>{ "bookingId", "userEmail", "tripId" }, "bookings.csv");
+    bookingsCursor.attachLog(log);
+    auto bookingsTable = table::Table(bookingsCursor, std::vector<std::string>{ "bookingId", "userEmail", "tripId" }, "bookings.csv",
+        { Serialization::INTEGER, Serialization::TEXT, Serialization::INTEGER });
+    bookingsTable.createIndex("userEmail");
 
     // Initialize the user table
     fileIO::FileStream usersFileStream("users.csv", "Users");
@@ -263,7 +269,10 @@ int main() {
     Serialization::Serializer usersSerializer;
     Serialization::FormatDescriptor usersFormatDescriptor;
     table::Cursor usersCursor(usersFileStream, usersDeserializer, usersSerializer, usersFormatDescriptor);
-    auto userTable = table::Table(usersCursor, std::vector<std::string>{ "userEmail", "password", "publicKey", "privateKey" }, "users.csv");
+    usersCursor.attachLog(log);
+    auto userTable = table::Table(usersCursor, std::vector<std::string>{ "userEmail", "password", "publicKey", "privateKey" }, "users.csv",
+        { Serialization::TEXT, Serialization::TEXT, Serialization::INTEGER, Serialization::INTEGER });
+    userTable.setRowCache(1 << 20);
     // Create the console application
     ConsoleApp app(userTable , tripsTable , bookingsTable);
 
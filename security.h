@@ -8,6 +8,7 @@
 #include <random>
 #include <cmath>
 #include <unordered_map>
+#include <stdexcept>
 class RSAManager {
 private:
     long long int n;
@@ -113,9 +114,9 @@ public:
     }
 };
 
-class AuthException : public std::exception {
+class AuthException : public std::runtime_error {
 public:
-    explicit AuthException(const char* message) : std::exception(message) {}
+    explicit AuthException(const char* message) : std::runtime_error(message) {}
 };
 
 class ExistingUserException : public AuthException {